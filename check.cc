@@ -1,10 +1,54 @@
 /* This is free and unencumbered software released into the public domain. */
 
 #include "lmdbxx/lmdb++.h"
+#include "lmdbxx/replication.h"
+#include "lmdbxx/reader_monitor.h"
+#include "lmdbxx/scan.h"
+#include "lmdbxx/merge_iterator.h"
+#include "lmdbxx/memtable.h"
+#include "lmdbxx/delta.h"
+#include "lmdbxx/sharded_env.h"
+#include "lmdbxx/analyzer.h"
+#include "lmdbxx/bloom.h"
+#include "lmdbxx/delay_queue.h"
+#include "lmdbxx/compaction.h"
+#include "lmdbxx/comparators.h"
+#include "lmdbxx/durability.h"
+#include "lmdbxx/hashed.h"
+#include "lmdbxx/optimistic.h"
+#include "lmdbxx/purge.h"
+#include "lmdbxx/queue.h"
+#include "lmdbxx/ttl.h"
+#include "lmdbxx/write_batch.h"
+#include "lmdbxx/snapshot.h"
+#if __cplusplus >= 202002L
+#include "lmdbxx/async.h"
+#endif
 
 #include <iostream>
+#include <map>
 #include <stdexcept>
+#include <cstdio>
 #include <filesystem>
+#include <future>
+#include <thread>
+#include <unistd.h>
+
+
+#if __cplusplus >= 202002L
+// Minimal eager coroutine type used to drive the async tests.
+struct check_task {
+  struct promise_type {
+    std::promise<void> done;
+    check_task get_return_object() { return {done.get_future()}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() { done.set_value(); }
+    void unhandled_exception() { done.set_exception(std::current_exception()); }
+  };
+  std::future<void> result;
+};
+#endif
 
 
 int main() {
@@ -356,6 +400,1241 @@ int main() {
 
 
 
+    // Log-shipping replication
+
+    {
+        std::filesystem::remove_all("testdb-repl/");
+        std::filesystem::create_directories("testdb-repl/leader/");
+        std::filesystem::create_directories("testdb-repl/follower/");
+
+        auto leaderEnv = lmdb::env::create();
+        leaderEnv.set_max_dbs(8);
+        leaderEnv.open("testdb-repl/leader/", envFlags);
+
+        auto followerEnv = lmdb::env::create();
+        followerEnv.set_max_dbs(8);
+        followerEnv.open("testdb-repl/follower/", envFlags);
+
+        std::string log;
+        lmdb::repl_leader leader(leaderEnv, [&](std::string_view frame){ log += frame; });
+
+        {
+            auto rtxn = leader.begin();
+            auto users = rtxn.open_dbi("users", MDB_CREATE);
+            rtxn.put(users, "alice", "1");
+            rtxn.put(users, "bob", "2");
+            rtxn.commit();
+        }
+
+        {
+            auto rtxn = leader.begin();
+            auto users = rtxn.open_dbi("users");
+            rtxn.del(users, "alice");
+            rtxn.put(users, "carol", "3");
+            rtxn.commit();
+        }
+
+        {
+            auto rtxn = leader.begin(); // nothing written, nothing logged
+            rtxn.abort();
+        }
+
+        lmdb::repl_follower follower(followerEnv);
+
+        if (follower.feed(log.substr(0, 5)) != 0 || follower.applied() != 0) throw std::runtime_error("repl partial frame");
+        if (follower.feed(log.substr(5)) != 2) throw std::runtime_error("repl frame count");
+        if (follower.applied() != leaderEnv.info().me_last_txnid) throw std::runtime_error("repl applied txnid");
+        if (follower.pending() != 0) throw std::runtime_error("repl pending");
+
+        auto checkFollower = [&]{
+            auto txn = lmdb::txn::begin(followerEnv, nullptr, MDB_RDONLY);
+            auto users = lmdb::dbi::open(txn, "users");
+            std::string_view v;
+            if (users.get(txn, "alice", v)) throw std::runtime_error("repl alice");
+            if (!users.get(txn, "bob", v) || v != "2") throw std::runtime_error("repl bob");
+            if (!users.get(txn, "carol", v) || v != "3") throw std::runtime_error("repl carol");
+            return users.size(txn);
+        };
+
+        if (checkFollower() != 2) throw std::runtime_error("repl follower size");
+
+        // Replaying the whole log is harmless
+
+        follower.feed(log);
+        if (checkFollower() != 2) throw std::runtime_error("repl replay");
+
+        // A fresh follower object resumes from the stored position
+
+        lmdb::repl_follower follower2(followerEnv);
+        if (follower2.applied() != follower.applied()) throw std::runtime_error("repl resume");
+
+        // Shipping over a pipe
+
+        int fds[2];
+        if (pipe(fds)) throw std::runtime_error("repl pipe");
+
+        lmdb::repl_leader pipeLeader(leaderEnv, lmdb::repl_leader::fd_sink(fds[1]));
+
+        {
+            auto rtxn = pipeLeader.begin();
+            auto users = rtxn.open_dbi("users");
+            rtxn.put(users, "dave", "4");
+            rtxn.commit();
+        }
+
+        close(fds[1]);
+        while (follower2.read_fd(fds[0])) {}
+        close(fds[0]);
+
+        {
+            auto txn = lmdb::txn::begin(followerEnv, nullptr, MDB_RDONLY);
+            auto users = lmdb::dbi::open(txn, "users");
+            std::string_view v;
+            if (!users.get(txn, "dave", v) || v != "4") throw std::runtime_error("repl dave");
+        }
+
+        bool caught = false;
+        try {
+            std::string bad = log;
+            bad[bad.size() - 1] ^= 1;
+            lmdb::repl_follower(followerEnv, "__other_repl").feed(bad);
+        } catch (const lmdb::corrupted_error&) {
+            caught = true;
+        }
+        if (!caught) throw std::runtime_error("repl checksum");
+
+        caught = false;
+        try {
+            /* a length of 2^64 - 1 can never be satisfied */
+            lmdb::repl_follower(followerEnv, "__other_repl").feed(std::string("\xA7\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x01", 11));
+        } catch (const lmdb::corrupted_error&) {
+            caught = true;
+        }
+        if (!caught) throw std::runtime_error("repl frame length");
+    }
+
+
+
+    // Reader monitoring
+
+    {
+        lmdb::reader_monitor monitor(env);
+        std::vector<lmdb::reader_monitor::stale_reader> stale;
+        monitor.set_max_lag(2).set_on_stale([&](const auto& r) { stale.push_back(r); });
+
+        auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        monitor.check();
+        if (monitor.active_readers() != 1) throw std::runtime_error("monitor readers 1");
+        if (monitor.oldest_reader_lag() != 0) throw std::runtime_error("monitor lag 1");
+
+        for (int i = 0; i < 2; i++) {
+            auto txn = lmdb::txn::begin(env);
+            mydb.put(txn, "reader_monitor", std::to_string(i));
+            txn.commit();
+        }
+
+        monitor.check();
+        if (monitor.oldest_reader_lag() != 2) throw std::runtime_error("monitor lag 2");
+        if (stale.size() != 1 || stale[0].reader.pid != getpid()) throw std::runtime_error("monitor stale 1");
+        monitor.check();
+        if (stale.size() != 1) throw std::runtime_error("monitor stale reported twice");
+
+        rtxn.reset();
+        monitor.check();
+        if (monitor.active_readers() != 0 || monitor.oldest_reader_lag() != 0) throw std::runtime_error("monitor reset reader");
+        rtxn.abort();
+
+        monitor.start(std::chrono::milliseconds(1));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        monitor.stop();
+        if (monitor.checks() < 4) throw std::runtime_error("monitor background checks");
+        if (monitor.last_error()) throw std::runtime_error("monitor background error");
+    }
+
+
+
+    // Refreshing scans
+
+    {
+        lmdb::dbi scandb, scandups;
+        {
+            auto txn = lmdb::txn::begin(env);
+            scandb = lmdb::dbi::open(txn, "scan", MDB_CREATE);
+            scandups = lmdb::dbi::open(txn, "scandups", MDB_CREATE | MDB_DUPSORT);
+            for (int i = 0; i < 10; i++) {
+                scandb.put(txn, "k" + std::to_string(i), std::to_string(i));
+                scandups.put(txn, "d", std::to_string(i));
+            }
+            txn.commit();
+        }
+
+        auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        lmdb::refreshing_scan scan(rtxn, scandb);
+        scan.set_max_records(3);
+
+        std::string seen;
+        std::string_view k, v;
+        while (scan.next(k, v)) {
+            seen += v;
+            if (v == "2") {
+                auto txn = lmdb::txn::begin(env);
+                scandb.del(txn, "k3");
+                scandb.del(txn, "k4");
+                scandb.del(txn, "k7");
+                scandb.put(txn, "k45", "X");
+                txn.commit();
+            }
+        }
+        if (seen != "012X5689") throw std::runtime_error("refreshing scan 1: " + seen);
+        if (scan.refreshes() != 2) throw std::runtime_error("refreshing scan refreshes");
+
+        lmdb::refreshing_scan dups(rtxn, scandups, "d");
+        seen.clear();
+        while (dups.next(k, v)) {
+            seen += v;
+            dups.refresh();
+        }
+        if (seen != "0123456789") throw std::runtime_error("refreshing scan dups: " + seen);
+    }
+
+
+
+    // Merge iterators
+
+    {
+        std::vector<lmdb::dbi> parts;
+        {
+            auto txn = lmdb::txn::begin(env);
+            const char* data[3][3] = {{"a", "c", "e"}, {"b", "c", nullptr}, {"c", "f", nullptr}};
+            for (int i = 0; i < 3; i++) {
+                parts.push_back(lmdb::dbi::open(txn, ("merge" + std::to_string(i)).c_str(), MDB_CREATE));
+                for (auto* k : data[i]) if (k) parts.back().put(txn, k, std::to_string(i));
+            }
+            for (int i = 3; i < 7; i++) {
+                parts.push_back(lmdb::dbi::open(txn, ("merge" + std::to_string(i)).c_str(), MDB_CREATE));
+                for (int j = i; j < 200; j += i) parts.back().put(txn, std::to_string(1000 + j), std::to_string(i));
+            }
+            txn.commit();
+        }
+
+        auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        std::vector<lmdb::cursor> cursors;
+        std::vector<MDB_cursor*> handles;
+        for (auto& p : parts) cursors.push_back(lmdb::cursor::open(txn, p));
+        for (auto& c : cursors) handles.push_back(c);
+
+        auto run = [&](std::vector<MDB_cursor*> sources, lmdb::merge_iterator::policy pol) {
+            lmdb::merge_iterator it(sources, pol);
+            std::string out;
+            std::string_view k, v;
+            while (it.next(k, v)) out += std::string(k) + std::string(v);
+            if (it.next(k, v)) throw std::runtime_error("merge iterator past end");
+            return out;
+        };
+        const std::vector<MDB_cursor*> three(handles.begin(), handles.begin() + 3);
+        if (run(three, lmdb::merge_iterator::policy::keep_all) != "a0b1c0c1c2e0f2") throw std::runtime_error("merge keep_all");
+        if (run(three, lmdb::merge_iterator::policy::first_wins) != "a0b1c0e0f2") throw std::runtime_error("merge first_wins");
+        if (run(three, lmdb::merge_iterator::policy::last_wins) != "a0b1c2e0f2") throw std::runtime_error("merge last_wins");
+
+        std::multimap<std::string, std::string> expected;
+        for (int i = 3; i < 7; i++) for (int j = i; j < 200; j += i) expected.emplace(std::to_string(1000 + j), std::to_string(i));
+        lmdb::merge_iterator it(handles);
+        it.seek("1000");
+        std::string_view k, v;
+        std::string prev;
+        std::size_t n = 0;
+        while (it.next(k, v)) {
+            if (k < prev) throw std::runtime_error("merge order");
+            prev = k;
+            if (it.source() >= 3) n++;
+        }
+        if (n != expected.size()) throw std::runtime_error("merge count");
+    }
+
+
+
+    // Memtable write buffer
+
+    {
+        lmdb::dbi memdb;
+        {
+            auto txn = lmdb::txn::begin(env);
+            memdb = lmdb::dbi::open(txn, "memtable", MDB_CREATE);
+            memdb.put(txn, "b", "old");
+            memdb.put(txn, "d", "old");
+            memdb.put(txn, "f", "old");
+            txn.commit();
+        }
+
+        lmdb::memtable mt(env, memdb, 0);
+        mt.put("z", "new");
+        mt.put("a", "new");
+        mt.put("d", "new");
+        mt.del("f");
+        mt.put("c", "tmp");
+        mt.del("c");
+        if (mt.size() != 5) throw std::runtime_error("memtable size");
+
+        auto dump = [&](lmdb::txn& txn, bool overlay) {
+            std::string out;
+            auto fn = [&](std::string_view k, std::string_view v) { out += std::string(k) + "=" + std::string(v) + ","; return true; };
+            if (overlay) {
+                mt.scan(txn, "", fn);
+            } else {
+                auto cursor = lmdb::cursor::open(txn, memdb);
+                std::string_view k, v;
+                while (cursor.get(k, v, MDB_NEXT)) fn(k, v);
+            }
+            return out;
+        };
+
+        {
+            auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+            std::string_view v;
+            if (!mt.get(txn, "d", v) || v != "new") throw std::runtime_error("memtable get overlay");
+            if (mt.get(txn, "f", v)) throw std::runtime_error("memtable get tombstone");
+            if (!mt.get(txn, "b", v) || v != "old") throw std::runtime_error("memtable get fallthrough");
+            if (dump(txn, true) != "a=new,b=old,d=new,z=new,") throw std::runtime_error("memtable scan overlay");
+            if (dump(txn, false) != "b=old,d=old,f=old,") throw std::runtime_error("memtable unflushed");
+        }
+
+        if (mt.flush() != 5 || mt.size() != 0 || mt.bytes() != 0) throw std::runtime_error("memtable flush");
+        {
+            auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+            if (dump(txn, false) != "a=new,b=old,d=new,z=new,") throw std::runtime_error("memtable flushed contents");
+        }
+
+        lmdb::memtable small(env, memdb, 64);
+        for (int i = 0; i < 20; i++) small.put("auto" + std::to_string(i), "0123456789");
+        if (small.size() >= 20) throw std::runtime_error("memtable auto flush");
+        small.flush();
+        {
+            auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+            std::string_view v;
+            if (!memdb.get(txn, "auto19", v)) throw std::runtime_error("memtable auto flush contents");
+        }
+    }
+
+
+
+    // Sharded environments
+
+    {
+        std::filesystem::remove_all("testdb-sharded/");
+        {
+            lmdb::sharded_env store("testdb-sharded/hash", 4, lmdb::sharded_env::hash_partitioner(), envFlags);
+
+            std::vector<std::thread> writers;
+            for (int t = 0; t < 4; t++) {
+                writers.emplace_back([&store, t] {
+                    std::vector<std::future<bool>> pending;
+                    for (int i = 0; i < 50; i++) {
+                        char key[16];
+                        snprintf(key, sizeof(key), "key%03d", t * 50 + i);
+                        pending.push_back(store.put_async(key, std::to_string(t)));
+                    }
+                    for (auto& f : pending) f.get();
+                });
+            }
+            for (auto& w : writers) w.join();
+
+            std::string v;
+            if (!store.get("key123", v) || v != "2") throw std::runtime_error("sharded get");
+            if (!store.del("key123") || store.get("key123", v)) throw std::runtime_error("sharded del");
+
+            std::string prev;
+            std::size_t n = store.scan("", "", [&](std::string_view k, std::string_view) {
+                if (!prev.empty() && std::string(k) <= prev) throw std::runtime_error("sharded scan order");
+                prev = k;
+                return true;
+            });
+            if (n != 199) throw std::runtime_error("sharded scan count");
+
+            std::vector<std::size_t> perShard(store.size());
+            for (std::size_t i = 0; i < store.size(); i++) {
+                auto txn = lmdb::txn::begin(store.env(i), nullptr, MDB_RDONLY);
+                MDB_stat st;
+                lmdb::dbi_stat(txn, lmdb::dbi::open(txn), &st);
+                perShard[i] = st.ms_entries;
+            }
+            for (auto c : perShard) if (c == 0) throw std::runtime_error("sharded distribution");
+        }
+
+        {
+            lmdb::sharded_env store("testdb-sharded/range", 3, lmdb::sharded_env::range_partitioner({"h", "p"}), envFlags);
+            if (store.shard_of("apple") != 0 || store.shard_of("h") != 1 || store.shard_of("zebra") != 2) throw std::runtime_error("sharded range partitioner");
+            std::vector<std::future<bool>> pending;
+            for (const char* k : {"apple", "kiwi", "mango", "pear", "zebra", "grape"}) pending.push_back(store.put_async(k, "fruit"));
+            for (auto& f : pending) f.get();
+
+            std::string keys;
+            store.scan("c", "q", [&](std::string_view k, std::string_view) { keys += std::string(k) + ","; return true; });
+            if (keys != "grape,kiwi,mango,pear,") throw std::runtime_error("sharded range scan: " + keys);
+        }
+
+        {
+            lmdb::sharded_env store("testdb-sharded/errors", 1, lmdb::sharded_env::hash_partitioner(), envFlags,
+                                    [](lmdb::env& e) { e.set_mapsize(1UL * 1024UL * 1024UL); });
+            auto failures = [](std::future<bool>& f) {
+                try { f.get(); } catch (const lmdb::error&) { return 1; }
+                return 0;
+            };
+            std::vector<std::future<bool>> pending;
+            pending.push_back(store.put_async("a", "1"));
+            pending.push_back(store.put_async(std::string(1000, 'k'), "too long a key"));
+            pending.push_back(store.put_async("b", std::string(2 * 1024 * 1024, 'v')));
+            pending.push_back(store.put_async("c", "3"));
+            pending.push_back(store.put_async("", "empty key"));
+            int failed[5];
+            for (int i = 0; i < 5; i++) failed[i] = failures(pending[i]);
+            if (failed[0] || !failed[1] || !failed[2] || failed[3] || !failed[4]) throw std::runtime_error("sharded failures");
+            std::string v;
+            if (!store.get("a", v) || !store.get("c", v) || store.get("b", v)) throw std::runtime_error("sharded failure isolation");
+        }
+    }
+
+
+
+    // Space utilization analysis
+
+    {
+        {
+            auto txn = lmdb::txn::begin(env);
+            auto bigdb = lmdb::dbi::open(txn, "analyzer", MDB_CREATE);
+            bigdb.put(txn, "small", "x");
+            bigdb.put(txn, "big", std::string(10000, 'b'));
+            lmdb::dbi::open(txn).put(txn, "analyzer_plain", "not a database");
+            txn.commit();
+        }
+
+        auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        const auto report = lmdb::analyze(txn);
+        if (report.page_size == 0 || report.used_pages == 0) throw std::runtime_error("analyzer env");
+        if (report.dbis.empty() || !report.dbis[0].name.empty()) throw std::runtime_error("analyzer main db");
+
+        const lmdb::dbi_report* found = nullptr;
+        for (const auto& d : report.dbis) {
+            if (d.name == "analyzer") found = &d;
+            if (d.name == "analyzer_plain") throw std::runtime_error("analyzer plain record");
+        }
+        if (!found) throw std::runtime_error("analyzer missing dbi");
+        if (found->stat.ms_entries != 2 || found->value_bytes != 10001) throw std::runtime_error("analyzer totals");
+        if (found->overflow_values != 1) throw std::runtime_error("analyzer overflow");
+        if (found->overflow_waste != 3 * report.page_size - 16 - 10000) throw std::runtime_error("analyzer overflow waste");
+        if (found->value_sizes[1] != 1 || found->value_sizes[14] != 1) throw std::runtime_error("analyzer histogram");
+
+        const auto& fl = report.freelist;
+        std::size_t runs = 0;
+        for (auto n : fl.run_lengths) runs += n;
+        if (runs != fl.runs || fl.largest_run > fl.pages) throw std::runtime_error("analyzer freelist");
+        if (report.reclaimable_bytes() != fl.pages * report.page_size) throw std::runtime_error("analyzer reclaimable");
+    }
+
+
+
+    // Online compaction
+
+    {
+        std::filesystem::remove_all("testdb-compact/");
+        std::filesystem::create_directories("testdb-compact/src/");
+        std::filesystem::create_directories("testdb-compact/dst/");
+        std::filesystem::create_directories("testdb-compact/replica/");
+
+        auto srcEnv = lmdb::env::create();
+        srcEnv.set_max_dbs(8);
+        srcEnv.open("testdb-compact/src/", envFlags);
+        auto dstEnv = lmdb::env::create();
+        dstEnv.set_max_dbs(8);
+        dstEnv.open("testdb-compact/dst/", envFlags);
+
+        std::string shipped;
+        lmdb::repl_leader leader(srcEnv, [&](std::string_view frame) { shipped += frame; });
+        MDB_dbi items, tags, root;
+        {
+            auto txn = leader.begin();
+            items = txn.open_dbi("items", MDB_CREATE);
+            tags = txn.open_dbi("tags", MDB_CREATE | MDB_DUPSORT);
+            root = txn.open_dbi(nullptr);
+            for (int i = 0; i < 25; i++) txn.put(items, "item" + std::to_string(100 + i), std::to_string(i));
+            txn.put(tags, "t", "b");
+            txn.put(tags, "t", "a");
+            txn.put(root, "zz_plain", "root record");
+            txn.commit();
+        }
+        for (int i = 0; i < 30; i++) {
+            /* push the source's transaction IDs past the destination's */
+            auto txn = leader.begin();
+            txn.put(root, "zz_counter", std::to_string(i));
+            txn.commit();
+        }
+
+        lmdb::online_compaction compaction(leader, dstEnv, 10);
+        compaction.copy();
+
+        {
+            auto txn = leader.begin();
+            txn.put(items, "item200", "new");
+            txn.del(items, "item100");
+            txn.commit();
+        }
+        if (compaction.backlog() == 0) throw std::runtime_error("compaction backlog");
+        if (compaction.catch_up() != 1) throw std::runtime_error("compaction catch up");
+
+        {
+            auto txn = leader.begin();
+            txn.put(tags, "t", "c");
+            txn.commit();
+        }
+
+        auto dump = [](lmdb::env& e) {
+            std::string out;
+            auto txn = lmdb::txn::begin(e, nullptr, MDB_RDONLY);
+            for (const char* name : {"items", "tags"}) {
+                auto db = lmdb::dbi::open(txn, name);
+                auto cursor = lmdb::cursor::open(txn, db);
+                std::string_view k, v;
+                while (cursor.get(k, v, MDB_NEXT)) out += std::string(k) + "=" + std::string(v) + ";";
+            }
+            std::string_view v;
+            if (lmdb::dbi::open(txn).get(txn, "zz_plain", v)) out += std::string(v);
+            return out;
+        };
+        const std::string before = dump(srcEnv);
+
+        compaction.swap([&]() -> MDB_env* {
+            srcEnv.close();
+            dstEnv.close();
+            std::filesystem::rename("testdb-compact/dst/data.mdb", "testdb-compact/src/data.mdb");
+            srcEnv = lmdb::env::create();
+            srcEnv.set_max_dbs(8);
+            srcEnv.open("testdb-compact/src/", envFlags);
+            return srcEnv;
+        });
+        if (leader.env() != srcEnv.handle()) throw std::runtime_error("compaction rebind");
+        if (leader.id_offset() == 0) throw std::runtime_error("compaction id offset");
+        if (dump(srcEnv) != before) throw std::runtime_error("compaction contents");
+
+        {
+            auto txn = lmdb::txn::begin(srcEnv, nullptr, MDB_RDONLY);
+            MDB_dbi meta;
+            if (::mdb_dbi_open(txn, lmdb::online_compaction::meta_name, 0, &meta) != MDB_NOTFOUND) throw std::runtime_error("compaction metadata");
+        }
+
+        {
+            auto txn = leader.begin();
+            auto db = txn.open_dbi("items");
+            txn.put(db, "item300", "after swap");
+            txn.commit();
+        }
+        auto has = [](lmdb::env& e, const char* key) {
+            auto txn = lmdb::txn::begin(e, nullptr, MDB_RDONLY);
+            std::string_view v;
+            return lmdb::dbi::open(txn, "items").get(txn, key, v);
+        };
+        if (!has(srcEnv, "item300")) throw std::runtime_error("compaction write after swap");
+
+        auto replicaEnv = lmdb::env::create();
+        replicaEnv.set_max_dbs(8);
+        replicaEnv.open("testdb-compact/replica/", envFlags);
+        lmdb::repl_follower replica(replicaEnv);
+        replica.feed(shipped);
+        if (!has(replicaEnv, "item300") || dump(replicaEnv) != dump(srcEnv)) throw std::runtime_error("compaction downstream follower");
+    }
+
+
+
+    // Durability manager
+
+    {
+        std::filesystem::remove_all("testdb-durability/");
+        std::filesystem::create_directories("testdb-durability/");
+        auto durEnv = lmdb::env::create();
+        durEnv.open("testdb-durability/", envFlags);
+
+        lmdb::durability_manager durability(durEnv);
+        unsigned int flags = 0;
+        lmdb::env_get_flags(durEnv, &flags);
+        if (!(flags & MDB_NOSYNC)) throw std::runtime_error("durability nosync");
+
+        lmdb::dbi durdb;
+        {
+            auto txn = lmdb::txn::begin(durEnv);
+            durdb = lmdb::dbi::open(txn);
+            durdb.put(txn, "a", "1");
+            auto done = durability.commit(txn, 2);
+            if (done.wait_for(std::chrono::milliseconds(0)) != std::future_status::timeout) throw std::runtime_error("durability early");
+            durability.sync();
+            if (done.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready) throw std::runtime_error("durability sync");
+        }
+
+        durability.set_dirty_threshold(100).start(std::chrono::hours(1));
+        {
+            auto txn = lmdb::txn::begin(durEnv);
+            durdb.put(txn, "b", std::string(200, 'x'));
+            auto done = durability.commit(txn, 200);
+            if (done.wait_for(std::chrono::seconds(5)) != std::future_status::ready) throw std::runtime_error("durability threshold");
+        }
+
+        durability.stop();
+        durability.start(std::chrono::milliseconds(2));
+        std::vector<std::future<void>> pending;
+        for (int i = 0; i < 5; i++) {
+            auto txn = lmdb::txn::begin(durEnv);
+            durdb.put(txn, "c" + std::to_string(i), "v");
+            pending.push_back(durability.commit(txn, 3));
+        }
+        for (auto& f : pending) if (f.wait_for(std::chrono::seconds(5)) != std::future_status::ready) throw std::runtime_error("durability interval");
+
+        {
+            auto txn = lmdb::txn::begin(durEnv);
+            auto empty = durability.commit(txn, 0);
+            if (empty.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready) throw std::runtime_error("durability empty txn");
+        }
+        if (durability.wait_durable(1).wait_for(std::chrono::milliseconds(0)) != std::future_status::ready) throw std::runtime_error("durability old txn");
+        durability.stop();
+    }
+
+
+
+    // Optimistic transactions
+
+    {
+        lmdb::dbi occdb;
+        {
+            auto txn = lmdb::txn::begin(env);
+            occdb = lmdb::dbi::open(txn, "optimistic", MDB_CREATE);
+            occdb.put(txn, "counter", "10");
+            txn.commit();
+        }
+
+        auto increment = [&](lmdb::optimistic_txn& otx) {
+            std::string_view v;
+            if (!otx.get(occdb, "counter", v)) throw std::runtime_error("optimistic get");
+            otx.put(occdb, "counter", std::to_string(std::stoi(std::string{v}) + 1));
+        };
+        if (lmdb::optimistic(env, increment) != 1) throw std::runtime_error("optimistic first attempt");
+
+        std::size_t calls = 0;
+        const auto attempts = lmdb::optimistic(env, [&](lmdb::optimistic_txn& otx) {
+            increment(otx);
+            if (++calls == 1) { /* a concurrent writer invalidates the read set */
+                std::thread([&] {
+                    auto txn = lmdb::txn::begin(env);
+                    occdb.put(txn, "counter", "100");
+                    txn.commit();
+                }).join();
+            }
+            std::string_view own;
+            if (!otx.get(occdb, "counter", own) || otx.reads() != 1) throw std::runtime_error("optimistic read own write");
+        });
+        if (attempts != 2) throw std::runtime_error("optimistic retry");
+
+        {
+            lmdb::optimistic_txn otx(env);
+            std::string_view v;
+            if (otx.get(occdb, "missing", v)) throw std::runtime_error("optimistic missing");
+            otx.put(occdb, "missing", "mine");
+            {
+                auto txn = lmdb::txn::begin(env);
+                occdb.put(txn, "missing", "theirs");
+                txn.commit();
+            }
+            if (otx.commit()) throw std::runtime_error("optimistic phantom");
+        }
+
+        if (lmdb::optimistic(env, [&](lmdb::optimistic_txn& otx) { otx.del(occdb, "missing"); return false; }) != 0) throw std::runtime_error("optimistic give up");
+
+        auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        std::string_view v;
+        if (!occdb.get(txn, "counter", v) || v != "101") throw std::runtime_error("optimistic result");
+        if (!occdb.get(txn, "missing", v) || v != "theirs") throw std::runtime_error("optimistic untouched");
+    }
+
+
+
+    // Merge and compare-and-swap
+
+    {
+        auto txn = lmdb::txn::begin(env);
+        auto mdb = lmdb::dbi::open(txn, "merge", MDB_CREATE);
+        auto add = [](std::optional<std::string_view> old) {
+            return std::to_string((old ? std::stoi(std::string{*old}) : 0) + 5);
+        };
+        if (mdb.merge(txn, "n", add)) throw std::runtime_error("merge absent");
+        if (!mdb.merge(txn, "n", add)) throw std::runtime_error("merge present");
+        std::string_view v;
+        if (!mdb.get(txn, "n", v) || v != "10") throw std::runtime_error("merge value");
+
+        if (mdb.compare_and_swap(txn, "n", "9", "11")) throw std::runtime_error("cas mismatch");
+        if (!mdb.compare_and_swap(txn, "n", "10", "11")) throw std::runtime_error("cas match");
+        if (mdb.compare_and_swap(txn, "n", std::nullopt, "0")) throw std::runtime_error("cas exists");
+        if (!mdb.compare_and_swap(txn, "m", std::nullopt, "0")) throw std::runtime_error("cas absent");
+        if (!mdb.get(txn, "n", v) || v != "11") throw std::runtime_error("cas value");
+        if (!mdb.get(txn, "m", v) || v != "0") throw std::runtime_error("cas insert");
+        if (mdb.size(txn) != 2) throw std::runtime_error("merge size");
+        txn.abort();
+    }
+
+
+
+    // Writable values
+
+    {
+        lmdb::dbi wdb;
+        {
+            auto txn = lmdb::txn::begin(env);
+            wdb = lmdb::dbi::open(txn, "writable", MDB_CREATE);
+            wdb.put(txn, "bits", "abcd");
+            wdb.put(txn, "count", lmdb::to_sv<uint64_t>(41));
+            txn.commit();
+        }
+        {
+            auto txn = lmdb::txn::begin(env);
+            char* data;
+            size_t size;
+            if (!wdb.get_writable(txn, "bits", data, size) || size != 4 || std::string_view(data, size) != "abcd") throw std::runtime_error("writable contents");
+            data[1] = 'X';
+            uint64_t* count = wdb.get_writable<uint64_t>(txn, "count");
+            if (!count) throw std::runtime_error("writable typed");
+            uint64_t n;
+            std::memcpy(&n, count, sizeof(n));
+            n++;
+            std::memcpy(count, &n, sizeof(n));
+            if (wdb.get_writable(txn, "none", data, size)) throw std::runtime_error("writable missing");
+            bool threw = false;
+            try { wdb.get_writable<uint32_t>(txn, "count"); } catch (lmdb::error&) { threw = true; }
+            if (!threw) throw std::runtime_error("writable size");
+            txn.commit();
+        }
+        {
+            auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+            std::string_view v;
+            if (!wdb.get(txn, "bits", v) || v != "aXcd") throw std::runtime_error("writable persisted");
+            if (!wdb.get(txn, "count", v) || lmdb::from_sv<uint64_t>(v) != 42) throw std::runtime_error("writable counter");
+        }
+    }
+
+
+
+    // Write batches
+
+    {
+        lmdb::dbi b1, b2;
+        {
+            auto txn = lmdb::txn::begin(env);
+            b1 = lmdb::dbi::open(txn, "batch1", MDB_CREATE);
+            b2 = lmdb::dbi::open(txn, "batch2", MDB_CREATE);
+            b1.put(txn, "gone", "x");
+            txn.commit();
+        }
+
+        lmdb::write_batch batch;
+        batch.put(b2, "z", "1").put(b1, "b", "old").put(b1, "a", "1");
+        batch.del(b1, "gone").del(b1, "never");
+        batch.put(b1, "b", "new").put(b2, "y", "").del(b2, "z");
+        if (batch.size() != 8) throw std::runtime_error("batch size");
+        if (batch.apply(env) != 6 || !batch.empty()) throw std::runtime_error("batch apply");
+
+        auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        std::string_view v;
+        if (!b1.get(txn, "a", v) || v != "1") throw std::runtime_error("batch a");
+        if (!b1.get(txn, "b", v) || v != "new") throw std::runtime_error("batch last wins");
+        if (b1.get(txn, "gone", v) || b2.get(txn, "z", v)) throw std::runtime_error("batch del");
+        if (!b2.get(txn, "y", v) || !v.empty()) throw std::runtime_error("batch empty value");
+    }
+
+
+
+    // Sorted deltas
+
+    {
+        auto txn = lmdb::txn::begin(env);
+        auto ddb = lmdb::dbi::open(txn, "delta", MDB_CREATE);
+        for (int i = 0; i < 100; i += 2) {
+            char k[16];
+            std::snprintf(k, sizeof(k), "k%03d", i);
+            ddb.put(txn, k, "orig");
+        }
+
+        std::vector<lmdb::delta> changes = {
+            {"a", "before"},
+            {"k000", std::nullopt},
+            {"k001", "new"},
+            {"k002", "updated"},
+            {"k003", std::nullopt},
+            {"k004", std::nullopt},
+            {"k090", "far"},
+            {"k090", "again"},
+            {"z1", "tail"},
+            {"z1", "tail2"},
+            {"z2", "tail"},
+        };
+        auto stats = lmdb::apply_sorted(txn, ddb, changes.begin(), changes.end(), 4);
+        if (stats.puts != 8 || stats.deletes != 2) throw std::runtime_error("delta counts");
+        if (stats.seeks != 3) throw std::runtime_error("delta seeks");
+
+        std::map<std::string, std::string> expected;
+        for (int i = 6; i < 100; i += 2) {
+            char k[16];
+            std::snprintf(k, sizeof(k), "k%03d", i);
+            expected[k] = "orig";
+        }
+        expected["a"] = "before";
+        expected["k001"] = "new";
+        expected["k002"] = "updated";
+        expected["k090"] = "again";
+        expected["z1"] = "tail2";
+        expected["z2"] = "tail";
+
+        std::map<std::string, std::string> actual;
+        {
+            auto cursor = lmdb::cursor::open(txn, ddb);
+            std::string_view k, v;
+            while (cursor.get(k, v, MDB_NEXT)) actual[std::string(k)] = std::string(v);
+        }
+        if (actual != expected) throw std::runtime_error("delta contents");
+        txn.abort();
+    }
+
+
+
+    // Range deletion
+
+    {
+        lmdb::dbi rdb;
+        {
+            auto txn = lmdb::txn::begin(env);
+            rdb = lmdb::dbi::open(txn, "purge", MDB_CREATE);
+            for (int i = 0; i < 50; i++) {
+                char k[16];
+                std::snprintf(k, sizeof(k), "t%02d", i);
+                rdb.put(txn, k, "v");
+            }
+            rdb.put(txn, "u00", "v");
+            txn.commit();
+        }
+
+        lmdb::purge_options opts;
+        opts.max_records = 7;
+        std::size_t reports = 0;
+        opts.on_progress = [&](const lmdb::purge_progress& p) { return ++reports < 3 && !p.done; };
+        auto progress = lmdb::del_range(env, rdb, "t10", "t40", opts);
+        if (progress.done || progress.deleted != 21 || progress.chunks != 3 || progress.next_key != "t31") throw std::runtime_error("del_range stop");
+
+        opts.on_progress = nullptr;
+        progress = lmdb::del_range(env, rdb, progress.next_key, "t40", opts);
+        if (!progress.done || progress.deleted != 9 || progress.chunks != 2 || !progress.next_key.empty()) throw std::runtime_error("del_range resume");
+
+        auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        std::string_view v;
+        if (rdb.size(txn) != 21 || !rdb.get(txn, "t09", v) || !rdb.get(txn, "t40", v) || rdb.get(txn, "t39", v)) throw std::runtime_error("del_range contents");
+        txn.abort();
+
+        progress = lmdb::del_range(env, rdb, "", "", opts);
+        if (!progress.done || progress.deleted != 21 || progress.chunks != 3) throw std::runtime_error("del_range all");
+    }
+
+
+
+    // Incremental drops
+
+    {
+        {
+            auto txn = lmdb::txn::begin(env);
+            auto big = lmdb::dbi::open(txn, "droppable", MDB_CREATE);
+            for (int i = 0; i < 25; i++) big.put(txn, std::to_string(1000 + i), "v");
+            txn.commit();
+        }
+
+        lmdb::purge_options opts;
+        opts.max_records = 10;
+        opts.on_progress = [](const lmdb::purge_progress&) { return false; };
+        auto progress = lmdb::drop_incremental(env, "droppable", opts);
+        if (progress.done || progress.deleted != 10) throw std::runtime_error("drop stopped");
+        {
+            auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+            if (!lmdb::is_dropping(txn, "droppable") || lmdb::is_dropping(txn, "other")) throw std::runtime_error("drop is_dropping");
+            if (lmdb::pending_drops(txn) != std::vector<std::string>{"droppable"}) throw std::runtime_error("drop pending");
+        }
+
+        opts.on_progress = nullptr;
+        if (lmdb::resume_drops(env, opts) != 1) throw std::runtime_error("drop resume");
+        {
+            auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+            MDB_dbi gone;
+            if (::mdb_dbi_open(txn, "droppable", 0, &gone) != MDB_NOTFOUND) throw std::runtime_error("drop gone");
+            if (!lmdb::pending_drops(txn).empty()) throw std::runtime_error("drop registry");
+        }
+        if (!lmdb::drop_incremental(env, "droppable").done) throw std::runtime_error("drop missing");
+    }
+
+
+
+    // Expiring keys
+
+    {
+        lmdb::ttl_dbi sessions(env, "sessions");
+        const auto past = lmdb::ttl_dbi::clock::now() - std::chrono::seconds(10);
+        {
+            auto txn = lmdb::txn::begin(env);
+            sessions.put(txn, "forever", "a");
+            sessions.put(txn, "later", "b", std::chrono::hours(1));
+            sessions.put(txn, "expired1", "c", past);
+            sessions.put(txn, "expired2", "d", past + std::chrono::seconds(1));
+            sessions.put(txn, "renewed", "e", past);
+            sessions.put(txn, "renewed", "f");
+            std::string_view v;
+            if (!sessions.get(txn, "later", v) || v != "b") throw std::runtime_error("ttl get");
+            if (sessions.get(txn, "expired1", v)) throw std::runtime_error("ttl lazy expiry");
+            if (!sessions.get(txn, "renewed", v) || v != "f") throw std::runtime_error("ttl renewed");
+            lmdb::ttl_dbi::clock::time_point when;
+            if (!sessions.expiry(txn, "forever", when) || when != lmdb::ttl_dbi::clock::time_point::max()) throw std::runtime_error("ttl expiry");
+            if (lmdb::dbi{sessions.index()}.size(txn) != 3) throw std::runtime_error("ttl index");
+            txn.commit();
+        }
+
+        if (sessions.set_batch(1).reap() != 2) throw std::runtime_error("ttl reap");
+        {
+            auto txn = lmdb::txn::begin(env);
+            if (lmdb::dbi{sessions.data()}.size(txn) != 3 || lmdb::dbi{sessions.index()}.size(txn) != 1) throw std::runtime_error("ttl reaped");
+            sessions.put(txn, "expired3", "g", past);
+            sessions.del(txn, "later");
+            if (lmdb::dbi{sessions.index()}.size(txn) != 1) throw std::runtime_error("ttl del");
+            txn.commit();
+        }
+
+        sessions.start(std::chrono::milliseconds(1));
+        for (int i = 0; i < 1000 && sessions.reaped() < 3; i++) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        sessions.stop();
+        if (sessions.reaped() != 3 || sessions.last_error()) throw std::runtime_error("ttl background reaper");
+    }
+
+
+
+    // Persistent queues
+
+    {
+        lmdb::queue q(env, "jobs");
+        {
+            auto txn = lmdb::txn::begin(env);
+            std::vector<std::string> batch = {"j1", "j2", "j3", "j4"};
+            if (q.enqueue(txn, batch.begin(), batch.end()) != 1) throw std::runtime_error("queue first seq");
+            if (q.enqueue(txn, "j5") != 5) throw std::runtime_error("queue append seq");
+            txn.commit();
+        }
+
+        std::string seen;
+        if (q.consume("a", 3, [&](uint64_t seq, std::string_view val) { seen += std::to_string(seq) + std::string(val); }) != 3) throw std::runtime_error("queue consume");
+        if (seen != "1j12j23j3") throw std::runtime_error("queue order");
+        bool threw = false;
+        try { q.consume("a", 10, [](uint64_t, std::string_view) { throw std::runtime_error("boom"); }); } catch (std::runtime_error&) { threw = true; }
+        if (!threw) throw std::runtime_error("queue throw");
+
+        {
+            auto txn = lmdb::txn::begin(env);
+            if (q.offset(txn, "a") != 4 || q.offset(txn, "b") != 1) throw std::runtime_error("queue offsets");
+            q.ack(txn, "b", 1);
+            q.ack(txn, "a", 2); // never moves backwards
+            if (q.trim(txn) != 1 || q.size(txn) != 4) throw std::runtime_error("queue trim acked");
+            q.set_max_records(2);
+            if (q.trim(txn) != 2 || q.size(txn) != 2) throw std::runtime_error("queue trim retention");
+            std::vector<uint64_t> got;
+            q.read(txn, "b", 10, [&](uint64_t seq, std::string_view) { got.push_back(seq); });
+            if (got != std::vector<uint64_t>{4, 5} || q.offset(txn, "a") != 4) throw std::runtime_error("queue read after trim");
+            q.ack(txn, "a", 5);
+            q.ack(txn, "b", 5);
+            if (q.trim(txn) != 1 || q.size(txn) != 1 || q.enqueue(txn, "j6") != 6) throw std::runtime_error("queue keeps newest");
+            txn.commit();
+        }
+    }
+
+
+
+    // Delay queues
+
+    {
+        lmdb::delay_queue dq(env, "scheduled");
+        const auto now = lmdb::delay_queue::clock::now();
+        uint64_t a, b;
+        {
+            auto txn = lmdb::txn::begin(env);
+            a = dq.schedule(txn, "A", now - std::chrono::seconds(2));
+            b = dq.schedule(txn, "B", now - std::chrono::seconds(1));
+            dq.schedule(txn, "C", std::chrono::hours(1));
+            txn.commit();
+        }
+        if (a != 1 || b != 2) throw std::runtime_error("delay ids");
+
+        auto jobs = dq.claim(10, std::chrono::seconds(30), now);
+        if (jobs.size() != 2 || jobs[0].id != a || jobs[0].payload != "A" || jobs[1].attempts != 1) throw std::runtime_error("delay claim");
+        if (!dq.claim(10, std::chrono::seconds(30), now).empty() || dq.polls() != 1) throw std::runtime_error("delay idle poll");
+        {
+            auto txn = lmdb::txn::begin(env);
+            if (!dq.ack(txn, a, jobs[0].token) || dq.ack(txn, a, jobs[0].token)) throw std::runtime_error("delay ack");
+            txn.commit();
+        }
+
+        auto again = dq.claim(10, std::chrono::seconds(30), now + std::chrono::seconds(31));
+        if (again.size() != 1 || again[0].id != b || again[0].attempts != 2 || dq.polls() != 2) throw std::runtime_error("delay lease expiry");
+        {
+            auto txn = lmdb::txn::begin(env);
+            if (dq.ack(txn, b, jobs[1].token)) throw std::runtime_error("delay stale token");
+            if (!dq.ack(txn, b, again[0].token)) throw std::runtime_error("delay new token");
+            if (dq.size(txn) != 1) throw std::runtime_error("delay size");
+            txn.commit();
+        }
+        if (dq.next_due() <= now || dq.next_due() == lmdb::delay_queue::clock::time_point::max()) throw std::runtime_error("delay next due");
+    }
+
+    // Bloom filter sidecars
+
+    {
+        MDB_dbi bdbi;
+        {
+            auto txn = lmdb::txn::begin(env);
+            bdbi = lmdb::dbi::open(txn, "bloomed", MDB_CREATE);
+            lmdb::dbi{bdbi}.put(txn, "preexisting", "p");
+            txn.commit();
+        }
+        {
+            lmdb::bloom_dbi bloom(env, bdbi, "bloomed__bloom", 1000);
+            if (!bloom.rebuilt() || !bloom.may_contain("preexisting")) throw std::runtime_error("bloom initial rebuild");
+            auto txn = lmdb::txn::begin(env);
+            for (int i = 0; i < 500; ++i) bloom.put(txn, "key" + std::to_string(i), "v");
+            bloom.save(txn);
+            txn.commit();
+
+            auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+            std::string_view v;
+            for (int i = 0; i < 500; ++i) {
+                if (!bloom.get(rtxn, "key" + std::to_string(i), v) || v != "v") throw std::runtime_error("bloom false negative");
+            }
+            for (int i = 0; i < 1000; ++i) bloom.get(rtxn, "absent" + std::to_string(i), v);
+            if (bloom.skipped() < 900) throw std::runtime_error("bloom false positive rate");
+        }
+        {
+            lmdb::bloom_dbi bloom(env, bdbi, "bloomed__bloom", 1000);
+            if (bloom.rebuilt() || !bloom.may_contain("key7")) throw std::runtime_error("bloom reload");
+            auto txn = lmdb::txn::begin(env);
+            bloom.put(txn, "unsaved", "u");
+            txn.commit();
+        }
+        {
+            lmdb::bloom_dbi bloom(env, bdbi, "bloomed__bloom", 1000);
+            if (!bloom.rebuilt() || !bloom.may_contain("unsaved")) throw std::runtime_error("bloom stale marker");
+            auto txn = lmdb::txn::begin(env);
+            lmdb::dbi{bdbi}.put(txn, "bypassed", "b");
+            txn.commit();
+        }
+        {
+            lmdb::bloom_dbi bloom(env, bdbi, "bloomed__bloom", 1000);
+            if (!bloom.rebuilt() || !bloom.may_contain("bypassed")) throw std::runtime_error("bloom record count");
+        }
+    }
+
+    // Hashed databases
+
+    {
+        auto txn = lmdb::txn::begin(env);
+        auto hdb = lmdb::hashed_dbi::open(txn, "hashed", MDB_CREATE);
+        if (!(lmdb::dbi{hdb}.flags(txn) & MDB_INTEGERKEY)) throw std::runtime_error("hashed flags");
+        const std::string long_key(48, 'k');
+        hdb.put(txn, long_key, "v1");
+        hdb.put(txn, "short", "s");
+        hdb.put(txn, long_key, "v2");
+        if (hdb.put(txn, "short", "x", MDB_NOOVERWRITE)) throw std::runtime_error("hashed nooverwrite");
+        std::string_view v;
+        if (!hdb.get(txn, long_key, v) || v != "v2" || hdb.size(txn) != 2) throw std::runtime_error("hashed replace");
+        if (hdb.get(txn, "missing", v)) throw std::runtime_error("hashed missing");
+
+        /* Plant a colliding record: same hash, different key. */
+        const std::size_t h = static_cast<std::size_t>(lmdb::detail::hash64("short"));
+        std::string planted;
+        lmdb::detail::put_bytes(planted, "other");
+        planted += "o";
+        lmdb::dbi{hdb}.put(txn, std::string_view{reinterpret_cast<const char*>(&h), sizeof(h)}, planted);
+        if (hdb.get(txn, "other", v)) throw std::runtime_error("hashed collision lookup");
+        if (!hdb.get(txn, "short", v) || v != "s") throw std::runtime_error("hashed collision resolve");
+        if (!hdb.del(txn, "short") || hdb.del(txn, "short") || hdb.size(txn) != 2) throw std::runtime_error("hashed del");
+        txn.abort();
+    }
+
+    // Comparator trampolines
+
+    {
+        if (lmdb::be_uint_compare<uint32_t>{}(std::string_view{"\0\0\0\x01", 4}, std::string_view{"\0\0\x01\0", 4}) >= 0) throw std::runtime_error("be_uint_compare");
+        if (lmdb::be_uint_compare<uint16_t>{}("\x01\x02", "\x01\x02") != 0) throw std::runtime_error("be_uint_compare equal");
+        if (lmdb::fixed_compare<4>{}("abcd", "abce") >= 0 || lmdb::fixed_compare<4>{}("abc", "abcd") >= 0) throw std::runtime_error("fixed_compare");
+
+        using by_fields = lmdb::tuple_compare<lmdb::lexical_compare>;
+        {
+            /* a malformed field must order the same way from either side */
+            const std::string_view good{"\x06" "abcdef"}, bad{"\x05"};
+            const int ab = by_fields{}(good, bad), ba = by_fields{}(bad, good);
+            if (ab == 0 || (ab < 0) == (ba < 0)) throw std::runtime_error("tuple_compare antisymmetry");
+        }
+        auto txn = lmdb::txn::begin(env);
+        auto tdb = lmdb::dbi::open(txn, "tupled", MDB_CREATE);
+        tdb.set_compare<by_fields>(txn);
+        tdb.put(txn, by_fields::key("b"), "3");
+        tdb.put(txn, by_fields::key("aa", "x"), "2");
+        tdb.put(txn, by_fields::key("aa"), "1");
+        std::string order;
+        {
+            auto cursor = lmdb::cursor::open(txn, tdb);
+            std::string_view k, v;
+            while (cursor.get(k, v, MDB_NEXT)) order += v;
+        }
+        if (order != "123") throw std::runtime_error("tuple_compare order");
+        txn.abort();
+    }
+
+    // Aligned values
+
+    {
+        struct alignas(8) fixed_record { uint64_t id; double score; uint32_t flags; };
+        auto txn = lmdb::txn::begin(env);
+        auto adb = lmdb::dbi::open(txn, "aligned", MDB_CREATE);
+        for (uint64_t i = 0; i < 200; ++i) {
+            adb.put_aligned(txn, std::string(1 + i % 13, 'k') + std::to_string(i), fixed_record{i, i * 0.5, 7});
+        }
+        if (adb.put_aligned(txn, "k0", fixed_record{}, MDB_NOOVERWRITE)) throw std::runtime_error("put_aligned nooverwrite");
+        for (uint64_t i = 0; i < 200; ++i) {
+            fixed_record copy;
+            const fixed_record* r = adb.get_aligned(txn, std::string(1 + i % 13, 'k') + std::to_string(i), copy);
+            if (!r || reinterpret_cast<std::uintptr_t>(r) % alignof(fixed_record) != 0) throw std::runtime_error("get_aligned alignment");
+            if (r->id != i || r->score != i * 0.5 || r->flags != 7) throw std::runtime_error("get_aligned value");
+        }
+        fixed_record copy;
+        if (adb.get_aligned(txn, "missing", copy)) throw std::runtime_error("get_aligned missing");
+
+        alignas(8) char buf[1 + sizeof(uint64_t)] = {};
+        uint64_t big = 0x0102030405060708, out = 0;
+        std::memcpy(buf + 1, &big, sizeof(big));
+        const uint64_t* p = lmdb::aligned_ptr_from_sv<uint64_t>(std::string_view{buf + 1, sizeof(big)}, out);
+        if (p != &out || out != big) throw std::runtime_error("aligned_ptr_from_sv fallback");
+
+        adb.put(txn, "plain", lmdb::to_sv<uint64_t>(1));
+        bool caught = false;
+        try {
+            adb.get_aligned(txn, "plain", copy);
+        } catch (const lmdb::error&) {
+            caught = true;
+        }
+        if (!caught) throw std::runtime_error("get_aligned foreign record");
+        txn.abort();
+    }
+
+
+
+#if __cplusplus >= 202002L
+    // Coroutine interface
+
+    {
+        lmdb::async_env adb(env, 2);
+
+        auto run = [&]() -> check_task {
+            co_await adb.put(mydb, "async_key", "async_val");
+            auto v = co_await adb.get(mydb, "async_key");
+            if (!v || *v != "async_val") throw std::runtime_error("async get");
+            if (co_await adb.get(mydb, "async_missing")) throw std::runtime_error("async missing");
+
+            const auto n = co_await adb.write([&](MDB_txn* txn) {
+                mydb.put(txn, "async_a", "1");
+                mydb.put(txn, "async_b", "2");
+                return 2;
+            });
+            if (n != 2) throw std::runtime_error("async write result");
+
+            bool caught = false;
+            try {
+                co_await adb.write([&](MDB_txn* txn) {
+                    mydb.put(txn, "async_rolled_back", "x");
+                    throw std::runtime_error("abort me");
+                });
+            } catch (const std::runtime_error&) {
+                caught = true;
+            }
+            if (!caught) throw std::runtime_error("async write exception");
+
+            const auto count = co_await adb.read([&](MDB_txn* txn) {
+                std::string_view val;
+                int found = 0;
+                for (const char* k : {"async_a", "async_b", "async_rolled_back"}) found += mydb.get(txn, k, val);
+                return found;
+            });
+            if (count != 2) throw std::runtime_error("async read");
+
+            co_await adb.del(mydb, "async_key");
+            if (co_await adb.get(mydb, "async_key")) throw std::runtime_error("async del");
+        };
+
+        run().result.get();
+    }
+#endif
+
+
+
+    // Shared snapshots
+
+    {
+        bool caught = false;
+        try {
+            lmdb::shared_snapshot::begin(env);
+        } catch (const lmdb::error& e) {
+            caught = (e.code() == EINVAL);
+        }
+        if (!caught) throw std::runtime_error("snapshot without MDB_NOTLS");
+
+        std::filesystem::remove_all("testdb-snapshot/");
+        std::filesystem::create_directories("testdb-snapshot/");
+        auto snapEnv = lmdb::env::create();
+        snapEnv.set_max_dbs(4);
+        snapEnv.open("testdb-snapshot/", envFlags | MDB_NOTLS);
+
+        lmdb::dbi snapdb;
+        {
+            auto txn = lmdb::txn::begin(snapEnv);
+            snapdb = lmdb::dbi::open(txn, "snap", MDB_CREATE);
+            for (int i = 0; i < 100; i++) snapdb.put(txn, std::to_string(i), "v");
+            txn.commit();
+        }
+
+        auto snapshot = lmdb::shared_snapshot::begin(snapEnv);
+        {
+            auto txn = lmdb::txn::begin(snapEnv);
+            snapdb.put(txn, "after", "v");
+            txn.commit();
+        }
+
+        std::vector<std::thread> workers;
+        std::vector<int> counts(4, 0);
+        for (int t = 0; t < 4; t++) {
+            workers.emplace_back([snapshot, snapdb, &counts, t] {
+                auto cursor = snapshot.cursor(snapdb);
+                std::string_view k, v;
+                while (cursor.get(k, v, MDB_NEXT)) counts[t]++;
+                if (snapshot.get(snapdb, "after", v)) counts[t] = -1;
+            });
+        }
+        for (auto& w : workers) w.join();
+        for (int c : counts) if (c != 100) throw std::runtime_error("snapshot count");
+
+        std::size_t active = 0;
+        for (const auto& r : lmdb::reader_table(snapEnv)) active += r.active;
+        if (active != 1) throw std::runtime_error("snapshot reader slots");
+
+        auto copy = snapshot;
+        snapshot.release();
+        if (copy.use_count() != 1) throw std::runtime_error("snapshot use count");
+        copy.release();
+        active = 0;
+        for (const auto& r : lmdb::reader_table(snapEnv)) active += r.active;
+        if (active != 0) throw std::runtime_error("snapshot release");
+    }
+
+
+
     if (0) {
         // This test case is not enabled by default because it causes the process
         // to crash. See the "Cursor double-free issue" section in README.md
@@ -0,0 +1,275 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_ANALYZER_H
+#define LMDBXX_ANALYZER_H
+
+/**
+ * <lmdbxx/analyzer.h> - Space utilization analysis for lmdb++.
+ *
+ * `mdb_stat()` reports only depth and page counts. `lmdb::analyze()` also
+ * walks the freelist database and every record of every database in a
+ * read-only transaction, and reports freelist fragmentation, value size
+ * distributions, overflow page usage, estimated leaf fill and reclaimable
+ * space.
+ *
+ * LMDB's public API does not expose individual pages, so leaf fill and
+ * overflow figures are estimates. They are computed from record sizes with
+ * the same node size rules that LMDB applies when it writes a record.
+ */
+
+#include "lmdb++.h"
+
+#include <algorithm>   /* for std::sort() */
+#include <array>       /* for std::array */
+#include <cstring>     /* for std::memcpy() */
+#include <string>      /* for std::string */
+#include <vector>      /* for std::vector */
+
+namespace lmdb {
+  using size_histogram = std::array<std::size_t, 8 * sizeof(std::size_t) + 1>;
+  struct freelist_report;
+  struct dbi_report;
+  struct env_report;
+  static inline freelist_report analyze_freelist(MDB_txn* txn);
+  static inline dbi_report analyze_dbi(MDB_txn* txn, MDB_dbi dbi);
+  static inline env_report analyze(MDB_txn* txn);
+}
+
+namespace lmdb::detail {
+  /** Size of an LMDB page header (`PAGEHDRSZ`). */
+  constexpr std::size_t page_header_size = 2 * sizeof(std::size_t);
+  /** Size of an LMDB node header (`NODESIZE`). */
+  constexpr std::size_t node_header_size = 8;
+
+  /** Histogram bucket of `n`: its bit width, so bucket `i` holds `[2^(i-1), 2^i)`. */
+  static inline std::size_t log2_bucket(std::size_t n) noexcept {
+    std::size_t bucket = 0;
+    while (n) { ++bucket; n >>= 1; }
+    return bucket;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Reports */
+
+/**
+ * Freelist (`FREE_DBI`) statistics.
+ */
+struct lmdb::freelist_report {
+  /** Number of freelist records (one per transaction that freed pages). */
+  std::size_t records{0};
+  /** Total number of free pages. */
+  std::size_t pages{0};
+  /** Number of maximal runs of consecutive free page numbers. */
+  std::size_t runs{0};
+  /** Length of the longest run, i.e. the largest multi-page value that fits without growing the file. */
+  std::size_t largest_run{0};
+  /** Run lengths, bucketed by `log2`. */
+  size_histogram run_lengths{};
+};
+
+/**
+ * Per-database statistics.
+ */
+struct lmdb::dbi_report {
+  /** Database name (empty for the main database). */
+  std::string name;
+  /** `mdb_stat()` result. */
+  MDB_stat stat{};
+  /** Sum of key sizes over all records. */
+  std::size_t key_bytes{0};
+  /** Sum of value sizes over all records. */
+  std::size_t value_bytes{0};
+  /** Estimated bytes used by leaf nodes (headers included). */
+  std::size_t leaf_bytes{0};
+  /** Number of values large enough to be stored on overflow pages. */
+  std::size_t overflow_values{0};
+  /** Unused bytes at the end of the last overflow page of each such value. */
+  std::size_t overflow_waste{0};
+  /** Value sizes, bucketed by `log2`. */
+  size_histogram value_sizes{};
+
+  /**
+   * Returns the estimated average leaf page fill factor, from 0 to 1.
+   */
+  double leaf_fill() const noexcept {
+    const std::size_t usable = stat.ms_leaf_pages * (stat.ms_psize - detail::page_header_size);
+    return usable ? static_cast<double>(leaf_bytes) / usable : 0.0;
+  }
+
+  /**
+   * Returns the estimated number of bytes of free space inside leaf pages.
+   */
+  std::size_t leaf_slack() const noexcept {
+    const std::size_t usable = stat.ms_leaf_pages * (stat.ms_psize - detail::page_header_size);
+    return usable > leaf_bytes ? usable - leaf_bytes : 0;
+  }
+};
+
+/**
+ * Environment-wide statistics.
+ */
+struct lmdb::env_report {
+  /** Page size in bytes. */
+  std::size_t page_size{0};
+  /** Pages in use up to the high-water mark (`me_last_pgno + 1`). */
+  std::size_t used_pages{0};
+  /** Pages available in the memory map. */
+  std::size_t map_pages{0};
+  /** Freelist statistics. */
+  freelist_report freelist;
+  /** Statistics for the main database, followed by each named database. */
+  std::vector<dbi_report> dbis;
+
+  /**
+   * Returns the number of bytes a compacting copy
+   * (`mdb_env_copy2()` with `MDB_CP_COMPACT`) would save.
+   */
+  std::size_t reclaimable_bytes() const noexcept {
+    return freelist.pages * page_size;
+  }
+
+  /**
+   * Returns the estimated free space inside leaf pages, over all databases.
+   * Compaction does not recover this; rewriting records in key order does.
+   */
+  std::size_t leaf_slack() const noexcept {
+    std::size_t result = 0;
+    for (const auto& d : dbis) result += d.leaf_slack();
+    return result;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Analysis */
+
+/**
+ * Walks the freelist database.
+ *
+ * @param txn a read-only transaction
+ * @throws lmdb::error on failure
+ */
+static inline lmdb::freelist_report
+lmdb::analyze_freelist(MDB_txn* const txn) {
+  freelist_report result;
+  std::vector<std::size_t> pages;
+
+  auto cursor = lmdb::cursor::open(txn, 0);
+  std::string_view key, val;
+  for (bool ok = cursor.get(key, val, MDB_FIRST); ok; ok = cursor.get(key, val, MDB_NEXT)) {
+    /* The value is an IDL: a count followed by that many page numbers. */
+    if (val.size() < sizeof(std::size_t)) continue;
+    std::size_t count;
+    std::memcpy(&count, val.data(), sizeof(count));
+    count = std::min(count, val.size() / sizeof(std::size_t) - 1);
+    for (std::size_t i = 1; i <= count; ++i) {
+      std::size_t pgno;
+      std::memcpy(&pgno, val.data() + i * sizeof(pgno), sizeof(pgno));
+      pages.push_back(pgno);
+    }
+    ++result.records;
+  }
+
+  std::sort(pages.begin(), pages.end());
+  result.pages = pages.size();
+  for (std::size_t i = 0; i < pages.size();) {
+    std::size_t j = i + 1;
+    while (j < pages.size() && pages[j] == pages[j - 1] + 1) ++j;
+    const std::size_t run = j - i;
+    ++result.runs;
+    ++result.run_lengths[detail::log2_bucket(run)];
+    result.largest_run = std::max(result.largest_run, run);
+    i = j;
+  }
+  return result;
+}
+
+/**
+ * Walks every record of a database.
+ *
+ * @param txn a read-only transaction
+ * @param dbi the database to analyze
+ * @throws lmdb::error on failure
+ */
+static inline lmdb::dbi_report
+lmdb::analyze_dbi(MDB_txn* const txn,
+                  const MDB_dbi dbi) {
+  dbi_report result;
+  lmdb::dbi_stat(txn, dbi, &result.stat);
+  unsigned int flags = 0;
+  lmdb::dbi_flags(txn, dbi, &flags);
+
+  /* LMDB moves a value to overflow pages once its node exceeds `me_nodemax`. */
+  const std::size_t psize = result.stat.ms_psize;
+  const std::size_t nodemax = (((psize - detail::page_header_size) / 2) & ~std::size_t{1}) - 2;
+
+  auto cursor = lmdb::cursor::open(txn, dbi);
+  std::string_view key, val;
+  for (bool ok = cursor.get(key, val, MDB_FIRST); ok; ok = cursor.get(key, val, MDB_NEXT)) {
+    result.key_bytes += key.size();
+    result.value_bytes += val.size();
+    ++result.value_sizes[detail::log2_bucket(val.size())];
+
+    std::size_t node = detail::node_header_size + key.size() + val.size();
+    if (!(flags & MDB_DUPSORT) && node > nodemax) {
+      node -= val.size() - sizeof(std::size_t);
+      const std::size_t ovpages = (detail::page_header_size - 1 + val.size()) / psize + 1;
+      ++result.overflow_values;
+      result.overflow_waste += ovpages * psize - detail::page_header_size - val.size();
+    }
+    result.leaf_bytes += ((node + 1) & ~std::size_t{1}) + 2;
+  }
+  return result;
+}
+
+/**
+ * Analyzes the freelist, the main database and every named database.
+ *
+ * Named databases are found by scanning the main database; they are opened
+ * (without `MDB_CREATE`) in `txn`, so the environment's `maxdbs` must allow
+ * for all of them.
+ *
+ * @param txn a read-only transaction
+ * @throws lmdb::error on failure
+ */
+static inline lmdb::env_report
+lmdb::analyze(MDB_txn* const txn) {
+  env_report result;
+
+  MDB_envinfo info;
+  lmdb::env_info(lmdb::txn_env(txn), &info);
+  MDB_stat st;
+  lmdb::env_stat(lmdb::txn_env(txn), &st);
+  result.page_size = st.ms_psize;
+  result.used_pages = info.me_last_pgno + 1;
+  result.map_pages = info.me_mapsize / st.ms_psize;
+
+  result.freelist = analyze_freelist(txn);
+
+  MDB_dbi main;
+  lmdb::dbi_open(txn, nullptr, 0, &main);
+  result.dbis.push_back(analyze_dbi(txn, main));
+
+  std::vector<std::string> names;
+  {
+    auto cursor = lmdb::cursor::open(txn, main);
+    std::string_view key;
+    for (bool ok = cursor.get(key, MDB_FIRST); ok; ok = cursor.get(key, MDB_NEXT_NODUP)) {
+      names.emplace_back(key);
+    }
+  }
+
+  for (auto& name : names) {
+    MDB_dbi dbi;
+    const int rc = ::mdb_dbi_open(txn, name.c_str(), 0, &dbi);
+    if (rc == MDB_INCOMPATIBLE) continue; /* a plain record, not a database */
+    if (rc != MDB_SUCCESS) error::raise("mdb_dbi_open", rc);
+    result.dbis.push_back(analyze_dbi(txn, dbi));
+    result.dbis.back().name = std::move(name);
+  }
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_ANALYZER_H */
@@ -0,0 +1,321 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_ASYNC_H
+#define LMDBXX_ASYNC_H
+
+/**
+ * <lmdbxx/async.h> - C++20 coroutine interface for lmdb++.
+ *
+ * `lmdb::async_env` runs transactions on dedicated threads so that
+ * coroutines never block their executor on page faults or on the write
+ * lock. Reads go to a pool of reader threads, each of which keeps its own
+ * read-only transaction and resets/renews it between jobs. Writes go to a
+ * single writer thread, one write transaction per job.
+ *
+ *     auto value = co_await db.get(mydb, "key");
+ *     co_await db.write([](MDB_txn* txn) { ... });
+ */
+
+#if __cplusplus < 202002L || !__has_include(<coroutine>)
+#error "<lmdbxx/async.h> requires C++20 coroutines"
+#endif
+
+#include "lmdb++.h"
+
+#include <condition_variable> /* for std::condition_variable */
+#include <coroutine>          /* for std::coroutine_handle<> */
+#include <deque>              /* for std::deque */
+#include <exception>          /* for std::exception_ptr */
+#include <functional>         /* for std::function */
+#include <mutex>              /* for std::mutex, std::unique_lock */
+#include <optional>           /* for std::optional */
+#include <string>             /* for std::string */
+#include <thread>             /* for std::thread */
+#include <type_traits>        /* for std::invoke_result_t<> */
+#include <utility>            /* for std::move() */
+#include <variant>            /* for std::monostate */
+#include <vector>             /* for std::vector */
+
+namespace lmdb {
+  class async_env;
+  template<class T, class F> class async_op;
+}
+
+namespace lmdb::detail {
+  class async_job;
+  class async_pool;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Async: Worker Threads */
+
+/**
+ * A unit of work queued on an `async_pool`. Jobs live in the frame of the
+ * suspended coroutine that awaits them, so queueing does not allocate.
+ */
+class lmdb::detail::async_job {
+public:
+  virtual ~async_job() = default;
+  /** Runs the job in `txn`, capturing its result or exception. */
+  virtual void run(MDB_txn* txn) noexcept = 0;
+  /** Records a failure that happened outside of `run()`. */
+  virtual void fail(std::exception_ptr error) noexcept = 0;
+  /** Returns whether the job failed. */
+  virtual bool failed() const noexcept = 0;
+  /** Resumes the awaiting coroutine. */
+  virtual void complete() noexcept = 0;
+};
+
+/**
+ * Threads that run queued jobs in read-only or write transactions.
+ */
+class lmdb::detail::async_pool {
+protected:
+  MDB_env* _env;
+  bool _rdonly;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::deque<async_job*> _jobs;
+  bool _stop{false};
+  std::vector<std::thread> _threads;
+
+  async_job* pop() {
+    std::unique_lock<std::mutex> lock{_mutex};
+    _cv.wait(lock, [this] { return _stop || !_jobs.empty(); });
+    if (_jobs.empty()) return nullptr;
+    auto* const job = _jobs.front();
+    _jobs.pop_front();
+    return job;
+  }
+
+  void read_loop() {
+    std::optional<lmdb::txn> txn;
+    while (auto* const job = pop()) {
+      try {
+        if (txn) txn->renew();
+        else txn.emplace(lmdb::txn::begin(_env, nullptr, MDB_RDONLY));
+        job->run(*txn);
+        txn->reset();
+      } catch (...) {
+        txn = std::nullopt;
+        job->fail(std::current_exception());
+      }
+      job->complete();
+    }
+  }
+
+  void write_loop() {
+    while (auto* const job = pop()) {
+      try {
+        auto txn = lmdb::txn::begin(_env);
+        job->run(txn);
+        if (job->failed()) txn.abort();
+        else txn.commit();
+      } catch (...) {
+        job->fail(std::current_exception());
+      }
+      job->complete();
+    }
+  }
+
+public:
+  async_pool(MDB_env* const env,
+             const bool rdonly,
+             const std::size_t threads)
+    : _env{env},
+      _rdonly{rdonly} {
+    for (std::size_t i = 0; i < (threads ? threads : 1); ++i) {
+      _threads.emplace_back([this] { _rdonly ? read_loop() : write_loop(); });
+    }
+  }
+
+  async_pool(const async_pool&) = delete;
+  async_pool& operator=(const async_pool&) = delete;
+
+  /**
+   * Destructor. Runs the jobs already queued, then joins the threads.
+   */
+  ~async_pool() noexcept {
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _stop = true;
+    }
+    _cv.notify_all();
+    for (auto& thread : _threads) thread.join();
+  }
+
+  void post(async_job* const job) {
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _jobs.push_back(job);
+    }
+    _cv.notify_one();
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Async: Operations */
+
+/**
+ * Awaitable returned by `lmdb::async_env`. Awaiting it runs `F` on a worker
+ * thread and resumes the coroutine with the result (or rethrows the
+ * exception) once the transaction has ended.
+ */
+template<class T, class F>
+class lmdb::async_op final : public lmdb::detail::async_job {
+protected:
+  using storage = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+  detail::async_pool* _pool;
+  const std::function<void(std::coroutine_handle<>)>* _executor;
+  F _fn;
+  std::optional<storage> _value;
+  std::exception_ptr _error;
+  std::coroutine_handle<> _handle;
+
+public:
+  async_op(detail::async_pool& pool,
+           const std::function<void(std::coroutine_handle<>)>& executor,
+           F fn)
+    : _pool{&pool},
+      _executor{&executor},
+      _fn{std::move(fn)} {}
+
+  void run(MDB_txn* const txn) noexcept override {
+    try {
+      if constexpr (std::is_void_v<T>) {
+        _fn(txn);
+        _value.emplace();
+      } else {
+        _value.emplace(_fn(txn));
+      }
+    } catch (...) {
+      _error = std::current_exception();
+    }
+  }
+
+  void fail(std::exception_ptr error) noexcept override {
+    _error = std::move(error);
+  }
+
+  bool failed() const noexcept override {
+    return static_cast<bool>(_error);
+  }
+
+  void complete() noexcept override {
+    if (*_executor) (*_executor)(_handle);
+    else _handle.resume();
+  }
+
+  bool await_ready() const noexcept {
+    return false;
+  }
+
+  void await_suspend(const std::coroutine_handle<> handle) {
+    _handle = handle;
+    _pool->post(this);
+  }
+
+  T await_resume() {
+    if (_error) std::rethrow_exception(_error);
+    if constexpr (!std::is_void_v<T>) return std::move(*_value);
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Async: Environments */
+
+/**
+ * Coroutine front end for an environment.
+ *
+ * By default a coroutine is resumed on the worker thread that completed its
+ * operation. Pass an `executor` to resume it elsewhere (e.g. by posting the
+ * handle to an event loop).
+ *
+ * @warning Values obtained through the transaction are only valid inside the
+ *          submitted function; copy whatever must outlive it.
+ * @warning Do not destroy an `async_env` from one of its own worker threads.
+ * @note Instances of this class are neither copyable nor movable.
+ */
+class lmdb::async_env {
+public:
+  using executor = std::function<void(std::coroutine_handle<>)>;
+  static constexpr std::size_t default_readers = 4;
+
+protected:
+  executor _executor;
+  detail::async_pool _readers;
+  detail::async_pool _writer;
+
+public:
+  /**
+   * Constructor. Starts the worker threads.
+   *
+   * @param env the environment (must allow one reader slot per reader thread)
+   * @param readers number of reader threads
+   * @param exec how to resume coroutines (by default, on the worker thread)
+   */
+  explicit async_env(MDB_env* const env,
+                     const std::size_t readers = default_readers,
+                     executor exec = {})
+    : _executor{std::move(exec)},
+      _readers{env, true, readers},
+      _writer{env, false, 1} {}
+
+  /**
+   * Runs `fn(MDB_txn*)` in a read-only transaction on a reader thread.
+   */
+  template<class F>
+  auto read(F fn) {
+    using T = std::invoke_result_t<F&, MDB_txn*>;
+    return async_op<T, F>{_readers, _executor, std::move(fn)};
+  }
+
+  /**
+   * Runs `fn(MDB_txn*)` in a write transaction on the writer thread. The
+   * transaction is committed if `fn` returns, and aborted if it throws.
+   */
+  template<class F>
+  auto write(F fn) {
+    using T = std::invoke_result_t<F&, MDB_txn*>;
+    return async_op<T, F>{_writer, _executor, std::move(fn)};
+  }
+
+  /**
+   * Retrieves a copy of the value stored under `key`, if any.
+   */
+  auto get(const MDB_dbi dbi,
+           std::string key) {
+    return read([dbi, key = std::move(key)](MDB_txn* const txn) -> std::optional<std::string> {
+      std::string_view val;
+      if (!lmdb::dbi{dbi}.get(txn, key, val)) return std::nullopt;
+      return std::string{val};
+    });
+  }
+
+  /**
+   * Stores a key/value pair in its own write transaction.
+   */
+  auto put(const MDB_dbi dbi,
+           std::string key,
+           std::string val,
+           const unsigned int flags = lmdb::dbi::default_put_flags) {
+    return write([dbi, key = std::move(key), val = std::move(val), flags](MDB_txn* const txn) {
+      return lmdb::dbi{dbi}.put(txn, key, val, flags);
+    });
+  }
+
+  /**
+   * Removes a key in its own write transaction.
+   */
+  auto del(const MDB_dbi dbi,
+           std::string key) {
+    return write([dbi, key = std::move(key)](MDB_txn* const txn) {
+      return lmdb::dbi{dbi}.del(txn, key);
+    });
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_ASYNC_H */
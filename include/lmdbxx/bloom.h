@@ -0,0 +1,345 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_BLOOM_H
+#define LMDBXX_BLOOM_H
+
+/**
+ * <lmdbxx/bloom.h> - Bloom filter sidecar for negative lookups in lmdb++.
+ *
+ * A `dbi::get()` for a key that does not exist still descends the whole
+ * B+ tree, often faulting in cold leaf pages only to find nothing.
+ * `lmdb::bloom_dbi` keeps a blocked Bloom filter of a database's keys in
+ * memory and answers most such misses without touching the tree. The
+ * filter is made of 64-byte blocks, one cache line each. A probe reads a
+ * single block and tests one bit in each of its eight words, in a
+ * fixed-width loop that compilers vectorize. The filter is persisted to a
+ * sidecar database and is rebuilt from the data when it is found to be stale.
+ */
+
+#include "lmdb++.h"
+#include "detail.h"
+
+#include <algorithm>   /* for std::max(), std::min() */
+#include <atomic>      /* for std::atomic */
+#include <cmath>       /* for std::ceil() */
+#include <cstddef>     /* for std::size_t */
+#include <cstdint>     /* for std::uint32_t, std::uint64_t */
+#include <cstring>     /* for std::memcpy() */
+#include <string>      /* for std::string */
+#include <string_view> /* for std::string_view */
+#include <vector>      /* for std::vector */
+
+namespace lmdb {
+  class bloom_filter;
+  class bloom_dbi;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Blocked Bloom Filters */
+
+/**
+ * A split-block Bloom filter over 64-byte blocks.
+ *
+ * Each key selects one block and sets one bit in each of the block's eight
+ * 64-bit words. With about 10 bits per key the false positive rate is
+ * roughly 1%.
+ *
+ * @note Instances of this class are copyable and movable.
+ */
+class lmdb::bloom_filter {
+public:
+  struct alignas(64) block {
+    std::uint64_t words[8];
+  };
+
+protected:
+  static constexpr std::uint32_t salt[8] = {
+    0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+    0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u,
+  };
+
+  std::vector<block> _blocks;
+
+  /* FNV-1a followed by a 64-bit finalizer, so that all bits are mixed. */
+  static std::uint64_t hash(const std::string_view key) noexcept {
+    std::uint64_t h = detail::hash64(key);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+  }
+
+  std::size_t block_of(const std::uint64_t h) const noexcept {
+    return static_cast<std::size_t>(((h >> 32) * _blocks.size()) >> 32);
+  }
+
+  static void masks(const std::uint64_t h,
+                    std::uint64_t (&out)[8]) noexcept {
+    const auto h32 = static_cast<std::uint32_t>(h);
+    for (int i = 0; i < 8; ++i) out[i] = std::uint64_t{1} << ((h32 * salt[i]) >> 26);
+  }
+
+public:
+  /**
+   * Constructor.
+   *
+   * @param keys the number of keys the filter is sized for
+   * @param bits_per_key filter bits per key
+   */
+  explicit bloom_filter(const std::size_t keys = 0,
+                        const double bits_per_key = 10)
+    : _blocks(std::max<std::size_t>(1, static_cast<std::size_t>(std::ceil(static_cast<double>(keys) * bits_per_key / 512))), block{}) {}
+
+  /**
+   * Returns the blocks, e.g. for persisting them.
+   */
+  std::vector<block>& blocks() noexcept {
+    return _blocks;
+  }
+
+  /**
+   * Returns the size of the filter in bytes.
+   */
+  std::size_t bytes() const noexcept {
+    return _blocks.size() * sizeof(block);
+  }
+
+  /**
+   * Adds a key.
+   */
+  void add(const std::string_view key) noexcept {
+    const std::uint64_t h = hash(key);
+    std::uint64_t m[8];
+    masks(h, m);
+    auto& b = _blocks[block_of(h)];
+    for (int i = 0; i < 8; ++i) b.words[i] |= m[i];
+  }
+
+  /**
+   * Returns false if `key` was definitely never added.
+   */
+  bool may_contain(const std::string_view key) const noexcept {
+    const std::uint64_t h = hash(key);
+    std::uint64_t m[8];
+    masks(h, m);
+    const auto& b = _blocks[block_of(h)];
+    std::uint64_t missing = 0;
+    for (int i = 0; i < 8; ++i) missing |= m[i] & ~b.words[i];
+    return missing == 0;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Filtered Databases */
+
+/**
+ * A database fronted by a Bloom filter of its keys.
+ *
+ * Writes made through `put()` keep the filter up to date. Deletes leave it
+ * as it is, which only costs false positives. `save()` persists the filter
+ * to the sidecar database. The constructor loads it from there if it is
+ * still fresh, and rebuilds it from the data otherwise. The filter counts as
+ * stale if a `put()` committed after the last `save()` (tracked by a marker
+ * record written in the same transaction), or if the number of records
+ * changed behind its back.
+ *
+ * The filter is only checked for staleness when it is loaded. Keys added
+ * afterwards by anything other than this instance's `put()` (another
+ * `bloom_dbi` on the same database, another process, or a plain
+ * `dbi::put()`) are missing from it, and `get()` reports them as absent
+ * until `rebuild()` is called or a new instance loads the filter. When
+ * loading, writes that bypass this class are only caught by the record
+ * count, so a delete plus a put elsewhere that leave the count unchanged go
+ * unnoticed.
+ *
+ * @warning `put()` must not run concurrently with `get()`/`may_contain()`.
+ * @note Instances of this class are neither copyable nor movable.
+ */
+class lmdb::bloom_dbi {
+protected:
+  static constexpr std::size_t chunk_blocks = 16384; /* 1 MiB per record */
+  static constexpr std::uint64_t byte_order_mark = 0x0102030405060708ull;
+
+  MDB_dbi _dbi;
+  MDB_dbi _sidecar;
+  std::size_t _expected_keys;
+  double _bits_per_key;
+  bloom_filter _filter;
+  std::atomic<std::size_t> _skipped{0};
+  bool _rebuilt{false};
+
+  static std::string chunk_key(const std::uint64_t index) {
+    std::string result{"c"};
+    detail::put_be64(result, index);
+    return result;
+  }
+
+  bool load(MDB_txn* const txn) {
+    lmdb::dbi sidecar{_sidecar};
+    std::string_view meta, v;
+    if (sidecar.get(txn, "dirty", v)) return false;
+    if (!sidecar.get(txn, "meta", meta) || meta.size() != 24) return false;
+    std::uint64_t mark;
+    std::memcpy(&mark, meta.data() + 16, sizeof(mark));
+    if (mark != byte_order_mark) return false;
+    const std::uint64_t nblocks = detail::get_be64(meta);
+    if (detail::get_be64(meta.substr(8)) != lmdb::dbi{_dbi}.size(txn)) return false;
+
+    std::vector<bloom_filter::block> blocks(static_cast<std::size_t>(nblocks));
+    for (std::uint64_t i = 0; i * chunk_blocks < nblocks; ++i) {
+      const std::size_t first = static_cast<std::size_t>(i * chunk_blocks);
+      const std::size_t count = std::min<std::size_t>(chunk_blocks, blocks.size() - first);
+      if (!sidecar.get(txn, chunk_key(i), v) || v.size() != count * sizeof(bloom_filter::block)) return false;
+      std::memcpy(static_cast<void*>(blocks.data() + first), v.data(), v.size());
+    }
+    _filter.blocks() = std::move(blocks);
+    return true;
+  }
+
+public:
+  /**
+   * Constructor. Opens (creating if needed) the sidecar database, then loads
+   * the filter from it, or rebuilds the filter if it is stale.
+   *
+   * @param env the environment
+   * @param dbi the database to filter
+   * @param sidecar_name the name of the sidecar database
+   * @param expected_keys the number of keys to size the filter for (the
+   *        current number of records is used if it is larger)
+   * @param bits_per_key filter bits per key
+   * @throws lmdb::error on failure
+   */
+  bloom_dbi(MDB_env* const env,
+            const MDB_dbi dbi,
+            const std::string& sidecar_name,
+            const std::size_t expected_keys = 0,
+            const double bits_per_key = 10)
+    : _dbi{dbi},
+      _expected_keys{expected_keys},
+      _bits_per_key{bits_per_key} {
+    auto txn = lmdb::txn::begin(env);
+    _sidecar = lmdb::dbi::open(txn, sidecar_name, MDB_CREATE);
+    if (!load(txn)) rebuild(txn);
+    txn.commit();
+  }
+
+  bloom_dbi(const bloom_dbi&) = delete;
+  bloom_dbi& operator=(const bloom_dbi&) = delete;
+
+  /**
+   * Returns the filter.
+   */
+  const bloom_filter& filter() const noexcept {
+    return _filter;
+  }
+
+  /**
+   * Returns whether the constructor had to rebuild the filter.
+   */
+  bool rebuilt() const noexcept {
+    return _rebuilt;
+  }
+
+  /**
+   * Returns the number of lookups answered by the filter alone.
+   */
+  std::size_t skipped() const noexcept {
+    return _skipped.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Returns false if `key` is definitely not in the database.
+   */
+  bool may_contain(const std::string_view key) const noexcept {
+    return _filter.may_contain(key);
+  }
+
+  /**
+   * Retrieves a value, consulting the filter first.
+   *
+   * @retval true  if the key was found
+   * @retval false if the key was not found
+   * @throws lmdb::error on failure
+   */
+  bool get(MDB_txn* const txn,
+           const std::string_view key,
+           std::string_view& val) {
+    if (!_filter.may_contain(key)) {
+      _skipped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    return lmdb::dbi{_dbi}.get(txn, key, val);
+  }
+
+  /**
+   * Stores a key/value pair and adds the key to the filter. The sidecar is
+   * marked stale in the same transaction until the next `save()`.
+   *
+   * @throws lmdb::error on failure
+   */
+  bool put(MDB_txn* const txn,
+           const std::string_view key,
+           const std::string_view val,
+           const unsigned int flags = lmdb::dbi::default_put_flags) {
+    lmdb::dbi sidecar{_sidecar};
+    std::string_view v;
+    if (!sidecar.get(txn, "dirty", v)) sidecar.put(txn, "dirty", {});
+    _filter.add(key);
+    return lmdb::dbi{_dbi}.put(txn, key, val, flags);
+  }
+
+  /**
+   * Removes a key. The filter keeps it, which only costs a false positive.
+   *
+   * @throws lmdb::error on failure
+   */
+  bool del(MDB_txn* const txn,
+           const std::string_view key) {
+    return lmdb::dbi{_dbi}.del(txn, key);
+  }
+
+  /**
+   * Persists the filter to the sidecar database and clears its stale marker.
+   *
+   * @param txn a write transaction (preferably the one of the last `put()`)
+   * @throws lmdb::error on failure
+   */
+  void save(MDB_txn* const txn) {
+    lmdb::dbi sidecar{_sidecar};
+    auto& blocks = _filter.blocks();
+    for (std::size_t first = 0, i = 0; first < blocks.size(); first += chunk_blocks, ++i) {
+      const std::size_t count = std::min(chunk_blocks, blocks.size() - first);
+      sidecar.put(txn, chunk_key(i), {reinterpret_cast<const char*>(blocks.data() + first), count * sizeof(bloom_filter::block)});
+    }
+    std::string meta;
+    detail::put_be64(meta, blocks.size());
+    detail::put_be64(meta, lmdb::dbi{_dbi}.size(txn));
+    meta.append(reinterpret_cast<const char*>(&byte_order_mark), sizeof(byte_order_mark));
+    sidecar.put(txn, "meta", meta);
+    sidecar.del(txn, "dirty");
+  }
+
+  /**
+   * Rebuilds the filter from the database's keys and saves it.
+   *
+   * @param txn a write transaction
+   * @throws lmdb::error on failure
+   */
+  void rebuild(MDB_txn* const txn) {
+    lmdb::dbi{_sidecar}.drop(txn); /* old chunks may outnumber the new ones */
+    _filter = bloom_filter{std::max(_expected_keys, lmdb::dbi{_dbi}.size(txn)), _bits_per_key};
+    {
+      auto cursor = lmdb::cursor::open(txn, _dbi);
+      std::string_view k, v;
+      while (cursor.get(k, v, MDB_NEXT_NODUP)) _filter.add(k);
+    }
+    save(txn);
+    _rebuilt = true;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_BLOOM_H */
@@ -0,0 +1,265 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_COMPACTION_H
+#define LMDBXX_COMPACTION_H
+
+/**
+ * <lmdbxx/compaction.h> - Online compaction for lmdb++.
+ *
+ * `mdb_env_copy2()` with `MDB_CP_COMPACT` needs writers to be stopped for
+ * the whole copy if the result is to replace the original. An
+ * `lmdb::online_compaction` instead copies a snapshot into a fresh
+ * environment with sequential `MDB_APPEND` writes, while writers keep
+ * running. It then catches up with the transactions those writers committed
+ * in the meantime, and finally pauses them briefly while the caller swaps
+ * environments and the leader is moved to the new one.
+ *
+ * Concurrent changes are captured through the replication write path
+ * (`<lmdbxx/replication.h>`), so all writes to the source environment must
+ * go through `lmdb::repl_leader::begin()` while a compaction is running.
+ */
+
+#include "lmdb++.h"
+#include "replication.h"
+
+#include <algorithm>   /* for std::binary_search() */
+#include <cstdint>     /* for std::uint64_t */
+#include <mutex>       /* for std::mutex, std::lock_guard */
+#include <optional>    /* for std::optional */
+#include <string>      /* for std::string */
+#include <vector>      /* for std::vector */
+
+namespace lmdb {
+  class online_compaction;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Online Compaction */
+
+/**
+ * Rewrites the environment of a `lmdb::repl_leader` into a fresh one, online.
+ *
+ * Usage: `copy()`, then `catch_up()` as often as useful, then `swap()`.
+ *
+ * The destination environment must be empty. It must allow one more named
+ * database than the source, because the replication position is kept in a
+ * database named `meta_name` until `swap()` removes it. Databases with
+ * custom comparators are not supported, as records are appended in the
+ * default key order.
+ *
+ * @note Instances of this class are neither copyable nor movable, and must
+ *       not outlive the leader.
+ */
+class lmdb::online_compaction {
+public:
+  static constexpr const char* meta_name = "__lmdbxx_compact";
+  static constexpr std::size_t default_batch_size = 10000;
+
+protected:
+  repl_leader& _leader;
+  MDB_env* _dst;
+  std::size_t _batch_size;
+  std::mutex _mutex;
+  std::string _log;
+  bool _capturing{false};
+  std::optional<repl_follower> _follower;
+  std::uint64_t _snapshot{0};
+
+  /* Copies one database with cursor appends, committing every `_batch_size`
+     records. Keys listed in `skip` (sorted) are left out. */
+  void copy_dbi(MDB_txn* const src,
+                const MDB_dbi src_dbi,
+                const char* const name,
+                const std::vector<std::string>& skip = {}) {
+    unsigned int flags = 0;
+    lmdb::dbi_flags(src, src_dbi, &flags);
+    flags &= MDB_REVERSEKEY | MDB_DUPSORT | MDB_INTEGERKEY | MDB_DUPFIXED | MDB_INTEGERDUP | MDB_REVERSEDUP;
+    const unsigned int append = (flags & MDB_DUPSORT) ? (MDB_APPEND | MDB_APPENDDUP) : MDB_APPEND;
+
+    auto in = lmdb::cursor::open(src, src_dbi);
+    std::string_view key, val;
+    bool more = in.get(key, val, MDB_FIRST);
+    do {
+      auto txn = lmdb::txn::begin(_dst);
+      const auto dbi = lmdb::dbi::open(txn, name, flags | MDB_CREATE);
+      {
+        auto out = lmdb::cursor::open(txn, dbi);
+        for (std::size_t n = 0; more && n < _batch_size; ++n) {
+          if (skip.empty() || !std::binary_search(skip.begin(), skip.end(), key)) {
+            out.put(key, val, append);
+          }
+          more = in.get(key, val, MDB_NEXT);
+        }
+      } /* the cursor must be closed before the commit */
+      txn.commit();
+    } while (more);
+  }
+
+public:
+  /**
+   * Constructor.
+   *
+   * @param leader the leader all writes to the source environment go through
+   * @param dst an empty destination environment
+   * @param batch_size maximum number of records copied per write transaction
+   */
+  online_compaction(repl_leader& leader,
+                    MDB_env* const dst,
+                    const std::size_t batch_size = default_batch_size)
+    : _leader{leader},
+      _dst{dst},
+      _batch_size{batch_size ? batch_size : 1} {}
+
+  online_compaction(const online_compaction&) = delete;
+  online_compaction& operator=(const online_compaction&) = delete;
+
+  /**
+   * Destructor. Stops capturing the leader's frames.
+   */
+  ~online_compaction() noexcept {
+    try { _leader.set_tap({}); } catch (...) {}
+  }
+
+  /**
+   * Returns the source transaction ID the copy was taken at.
+   */
+  std::uint64_t snapshot_txnid() const noexcept {
+    return _snapshot;
+  }
+
+  /**
+   * Returns the number of captured log bytes not yet applied.
+   */
+  std::size_t backlog() {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _log.size();
+  }
+
+  /**
+   * Copies a snapshot of every database into the destination environment.
+   * Writers are only paused while the snapshot is being taken.
+   *
+   * @throws lmdb::error on failure
+   */
+  void copy() {
+    _leader.set_tap([this](const std::string_view frame) {
+      std::lock_guard<std::mutex> lock{_mutex};
+      if (_capturing) _log.append(frame.data(), frame.size());
+    });
+
+    lmdb::txn src{nullptr};
+    {
+      auto paused = _leader.pause();
+      {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _capturing = true;
+        _log.clear();
+      }
+      src = lmdb::txn::begin(_leader.env(), nullptr, MDB_RDONLY);
+      MDB_envinfo info;
+      lmdb::env_info(_leader.env(), &info);
+      _snapshot = info.me_last_txnid;
+    }
+
+    /* Plain records and named databases share the main database; the
+       latter are copied separately. */
+    MDB_dbi main;
+    lmdb::dbi_open(src, nullptr, 0, &main);
+    std::vector<std::string> keys, names;
+    std::vector<MDB_dbi> dbis;
+    {
+      auto cursor = lmdb::cursor::open(src, main);
+      std::string_view key;
+      for (bool ok = cursor.get(key, MDB_FIRST); ok; ok = cursor.get(key, MDB_NEXT_NODUP)) {
+        keys.emplace_back(key);
+      }
+    }
+    for (auto& name : keys) {
+      MDB_dbi dbi;
+      const int rc = ::mdb_dbi_open(src, name.c_str(), 0, &dbi);
+      if (rc == MDB_INCOMPATIBLE) continue; /* a plain record */
+      if (rc != MDB_SUCCESS) error::raise("mdb_dbi_open", rc);
+      names.push_back(std::move(name));
+      dbis.push_back(dbi);
+    }
+
+    copy_dbi(src, main, nullptr, names);
+    for (std::size_t i = 0; i < names.size(); ++i) {
+      copy_dbi(src, dbis[i], names[i].c_str());
+    }
+    src.abort();
+
+    {
+      auto txn = lmdb::txn::begin(_dst);
+      auto meta = lmdb::dbi::open(txn, meta_name, MDB_CREATE);
+      meta.put(txn, repl_follower::applied_key, lmdb::to_sv(_snapshot));
+      txn.commit();
+    }
+    _follower.emplace(_dst, meta_name);
+  }
+
+  /**
+   * Applies the transactions committed since the snapshot (or since the
+   * previous call). Writers are not paused.
+   *
+   * @returns the number of frames applied
+   * @throws lmdb::error on failure
+   */
+  std::size_t catch_up() {
+    if (!_follower) error::raise("online_compaction: copy() was not called", EINVAL);
+    std::string log;
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      log.swap(_log);
+    }
+    return _follower->feed(log);
+  }
+
+  /**
+   * Pauses writers, applies the remaining transactions, removes the
+   * replication metadata from the destination, and calls `fn` while writers
+   * are still paused. `fn` would typically close the source environment,
+   * move the destination's data file into place and reopen it. It returns
+   * the `MDB_env*` writers continue on, and the leader is rebound to it
+   * (see `repl_leader::rebind()`) before writers resume. The leader's last
+   * transaction ID is read before `fn` runs, so `fn` may close the source
+   * environment.
+   *
+   * @throws lmdb::error on failure
+   */
+  template<class F>
+  void swap(F&& fn) {
+    {
+      auto paused = _leader.pause();
+      catch_up();
+      {
+        auto txn = lmdb::txn::begin(_dst);
+        lmdb::dbi::open(txn, meta_name).drop(txn, true);
+        txn.commit();
+      }
+      {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _capturing = false;
+      }
+      _follower.reset();
+      const std::uint64_t last = _leader.last_id();
+      MDB_env* const env = fn();
+      _leader.rebind(paused, env, last);
+    }
+    _leader.set_tap({});
+  }
+
+  /**
+   * Like `swap(fn)`, but simply moves the leader to the destination
+   * environment.
+   *
+   * @throws lmdb::error on failure
+   */
+  void swap() {
+    swap([this] { return _dst; });
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_COMPACTION_H */
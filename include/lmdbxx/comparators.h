@@ -0,0 +1,161 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_COMPARATORS_H
+#define LMDBXX_COMPARATORS_H
+
+/**
+ * <lmdbxx/comparators.h> - Key comparators for lmdb++.
+ *
+ * LMDB calls the key comparator at every level of every lookup, so its cost
+ * adds up quickly in databases with a custom order. The comparator types in
+ * this header are meant for `dbi::set_compare<Comparator>()`. That function
+ * instantiates a static function per type, so each comparator can be
+ * specialized for its key layout and inlined into the function LMDB calls.
+ * Every comparator falls back to LMDB's default lexicographic order for
+ * keys that do not have the expected shape.
+ */
+
+#include "lmdb++.h"
+#include "detail.h"
+
+#include <algorithm>   /* for std::min() */
+#include <cstddef>     /* for std::size_t */
+#include <cstdint>     /* for std::uint16_t, std::uint32_t, std::uint64_t */
+#include <cstring>     /* for std::memcmp(), std::memcpy() */
+#include <string>      /* for std::string */
+#include <string_view> /* for std::string_view */
+#include <tuple>       /* for std::tuple, std::tuple_element_t */
+#include <type_traits> /* for std::is_integral, std::is_unsigned */
+
+namespace lmdb {
+  struct lexical_compare;
+  template<class T> struct be_uint_compare;
+  template<std::size_t N> struct fixed_compare;
+  template<class... Fields> struct tuple_compare;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Byte Strings */
+
+/**
+ * LMDB's default order: `memcmp()` over the common prefix, then shorter first.
+ */
+struct lmdb::lexical_compare {
+  int operator()(const std::string_view a,
+                 const std::string_view b) const noexcept {
+    const int r = std::memcmp(a.data(), b.data(), std::min(a.size(), b.size()));
+    if (r) return r;
+    return a.size() < b.size() ? -1 : a.size() > b.size() ? 1 : 0;
+  }
+};
+
+/**
+ * Keys of exactly `N` bytes, compared with a `memcmp()` of constant size.
+ * Compilers expand that into a few wide loads and compares instead of a
+ * library call.
+ */
+template<std::size_t N>
+struct lmdb::fixed_compare {
+  int operator()(const std::string_view a,
+                 const std::string_view b) const noexcept {
+    if (a.size() != N || b.size() != N) return lexical_compare{}(a, b);
+    return std::memcmp(a.data(), b.data(), N);
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Integers */
+
+/**
+ * Unsigned integers of type `T` stored big-endian (so that the keys also
+ * scan in numeric order with the default comparator). Each key is loaded
+ * with a single unaligned read and byte-swapped, and the two keys are
+ * compared as integers.
+ */
+template<class T>
+struct lmdb::be_uint_compare {
+  static_assert(std::is_integral_v<T> && std::is_unsigned_v<T>, "T must be an unsigned integer type");
+
+  static T load(const char* const p) noexcept {
+    T v;
+    std::memcpy(&v, p, sizeof(T));
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if constexpr (sizeof(T) == 8) v = static_cast<T>(__builtin_bswap64(v));
+    else if constexpr (sizeof(T) == 4) v = static_cast<T>(__builtin_bswap32(v));
+    else if constexpr (sizeof(T) == 2) v = static_cast<T>(__builtin_bswap16(v));
+#elif !(defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    v = 0;
+    for (std::size_t i = 0; i < sizeof(T); ++i) {
+      v = static_cast<T>((v << 8) | static_cast<unsigned char>(p[i]));
+    }
+#endif
+    return v;
+  }
+
+  int operator()(const std::string_view a,
+                 const std::string_view b) const noexcept {
+    if (a.size() != sizeof(T) || b.size() != sizeof(T)) return lexical_compare{}(a, b);
+    const T x = load(a.data()), y = load(b.data());
+    return x < y ? -1 : x > y ? 1 : 0;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Tuples */
+
+/**
+ * Composite keys made of length-prefixed fields, as built by `key()`. Each
+ * field is a varint length followed by its bytes. Fields are compared in
+ * turn: the i-th with the i-th comparator in `Fields`, and any further ones
+ * lexicographically. A key that is a field-wise prefix of another sorts
+ * first.
+ *
+ * Unlike plain concatenation, the length prefixes keep a short field from
+ * comparing against the start of the next one, e.g. `("ab", "c")` sorts
+ * before `("abc", "")`.
+ */
+template<class... Fields>
+struct lmdb::tuple_compare {
+  /**
+   * Builds a key from its fields (anything convertible to `std::string_view`).
+   */
+  template<class... Parts>
+  static std::string key(const Parts&... parts) {
+    std::string result;
+    (detail::put_bytes(result, std::string_view{parts}), ...);
+    return result;
+  }
+
+  int operator()(const std::string_view a,
+                 const std::string_view b) const noexcept {
+    return compare_from<0>(a, b);
+  }
+
+protected:
+  template<std::size_t I>
+  static int compare_from(std::string_view a,
+                          std::string_view b) noexcept {
+    for (;;) {
+      if (a.empty() || b.empty()) return a.empty() ? (b.empty() ? 0 : -1) : 1;
+      /* Decode both fields before consuming either key, so that a malformed
+         field compares the same remainders whichever side it is on. */
+      std::string_view ra = a, rb = b, fa, fb;
+      const bool ok_a = detail::get_bytes(ra, fa);
+      const bool ok_b = detail::get_bytes(rb, fb);
+      if (!ok_a || !ok_b) return lexical_compare{}(a, b);
+      a = ra;
+      b = rb;
+      if constexpr (I < sizeof...(Fields)) {
+        const int r = std::tuple_element_t<I, std::tuple<Fields...>>{}(fa, fb);
+        return r ? r : compare_from<I + 1>(a, b);
+      } else {
+        const int r = lexical_compare{}(fa, fb);
+        if (r) return r;
+      }
+    }
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_COMPARATORS_H */
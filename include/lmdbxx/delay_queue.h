@@ -0,0 +1,293 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_DELAY_QUEUE_H
+#define LMDBXX_DELAY_QUEUE_H
+
+/**
+ * <lmdbxx/delay_queue.h> - Durable delayed-job scheduler for lmdb++.
+ *
+ * `lmdb::delay_queue` stores jobs keyed by the time they become due. Workers
+ * claim due jobs in batches. A claim gives each job a lease: the job is
+ * rescheduled at the end of the lease, and a random token is recorded in
+ * the same transaction. A worker that finishes in time acknowledges the job
+ * with its token. A job whose worker died becomes due again once the lease
+ * runs out. The queue also remembers the earliest due time in memory, so
+ * polling an idle queue does not open any transaction.
+ */
+
+#include "lmdb++.h"
+#include "detail.h"
+
+#include <atomic>      /* for std::atomic */
+#include <chrono>      /* for std::chrono::* */
+#include <cstddef>     /* for std::size_t */
+#include <cstdint>     /* for std::uint64_t */
+#include <limits>      /* for std::numeric_limits */
+#include <mutex>       /* for std::mutex, std::lock_guard */
+#include <random>      /* for std::mt19937_64, std::random_device */
+#include <string>      /* for std::string */
+#include <string_view> /* for std::string_view */
+#include <vector>      /* for std::vector */
+
+namespace lmdb {
+  struct delay_job;
+  class delay_queue;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Delay Queues */
+
+/**
+ * A job handed out by `lmdb::delay_queue::claim()`.
+ */
+struct lmdb::delay_job {
+  std::uint64_t id;       /**< the job's ID, as returned by `schedule()` */
+  std::uint64_t token;    /**< the lease token to pass to `ack()` */
+  std::uint64_t attempts; /**< how many times the job has been claimed */
+  std::string payload;
+};
+
+/**
+ * A persistent queue of jobs that become visible at a given time.
+ *
+ * Jobs live in the database `name`. Its keys are the due time (big-endian
+ * milliseconds since the epoch) followed by the job ID, and its values are
+ * the payloads. Leases live in `name` + `"__leases"`. They are keyed by job
+ * ID and hold the job's current due time, its token and its attempt count.
+ * Key zero of that database holds the next job ID.
+ *
+ * The in-memory next-due time only knows about jobs scheduled through this
+ * instance. Jobs scheduled by other processes are picked up by the periodic
+ * check configured with `set_refresh_interval()`.
+ *
+ * @note Instances of this class are neither copyable nor movable.
+ */
+class lmdb::delay_queue {
+public:
+  using clock = std::chrono::system_clock;
+
+protected:
+  static constexpr std::uint64_t unknown = 0;
+  static constexpr std::uint64_t never = std::numeric_limits<std::uint64_t>::max();
+
+  MDB_env* _env;
+  MDB_dbi _jobs;
+  MDB_dbi _leases;
+  std::atomic<std::uint64_t> _next_due{unknown};
+  std::atomic<std::uint64_t> _last_poll{0};
+  std::atomic<std::uint64_t> _refresh_ms{1000};
+  std::atomic<std::size_t> _polls{0};
+  std::mutex _rng_mutex;
+  std::mt19937_64 _rng{std::random_device{}()};
+
+  static std::uint64_t to_millis(const clock::time_point t) noexcept {
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t.time_since_epoch()).count();
+    return ms > 0 ? static_cast<std::uint64_t>(ms) : 0;
+  }
+
+  static std::string job_key(const std::uint64_t due,
+                             const std::uint64_t id) {
+    std::string result;
+    detail::put_be64(result, due);
+    detail::put_be64(result, id);
+    return result;
+  }
+
+  static std::string id_key(const std::uint64_t id) {
+    std::string result;
+    detail::put_be64(result, id);
+    return result;
+  }
+
+  static std::string lease_record(const std::uint64_t due,
+                                  const std::uint64_t token,
+                                  const std::uint64_t attempts) {
+    std::string result;
+    detail::put_be64(result, due);
+    detail::put_be64(result, token);
+    detail::put_be64(result, attempts);
+    return result;
+  }
+
+  void lower_next_due(const std::uint64_t due) noexcept {
+    std::uint64_t current = _next_due.load();
+    /* An unknown next-due time stays unknown: older jobs may be waiting. */
+    while (current != unknown && due < current && !_next_due.compare_exchange_weak(current, due)) {}
+  }
+
+  std::uint64_t new_token() {
+    std::lock_guard<std::mutex> lock{_rng_mutex};
+    std::uint64_t token;
+    do token = _rng(); while (token == 0);
+    return token;
+  }
+
+public:
+  /**
+   * Constructor. Opens (creating if needed) the job and lease databases.
+   *
+   * @param env the environment (`set_max_dbs()` must allow two more databases)
+   * @param name the name of the job database
+   * @throws lmdb::error on failure
+   */
+  delay_queue(MDB_env* const env,
+              const std::string& name)
+    : _env{env} {
+    auto txn = lmdb::txn::begin(env);
+    _jobs = lmdb::dbi::open(txn, name, MDB_CREATE);
+    _leases = lmdb::dbi::open(txn, name + "__leases", MDB_CREATE);
+    txn.commit();
+  }
+
+  delay_queue(const delay_queue&) = delete;
+  delay_queue& operator=(const delay_queue&) = delete;
+
+  /**
+   * Sets how often `claim()` looks at the database even though no job is
+   * known to be due, to catch jobs scheduled by other processes.
+   */
+  template<class Rep, class Period>
+  delay_queue& set_refresh_interval(const std::chrono::duration<Rep, Period> interval) noexcept {
+    _refresh_ms = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(interval).count());
+    return *this;
+  }
+
+  /**
+   * Returns the earliest due time known, or `clock::time_point::max()` if
+   * the queue is known to be empty, or `clock::time_point::min()` if unknown.
+   */
+  clock::time_point next_due() const noexcept {
+    const std::uint64_t due = _next_due.load();
+    if (due == unknown) return clock::time_point::min();
+    if (due == never) return clock::time_point::max();
+    return clock::time_point{std::chrono::duration_cast<clock::duration>(std::chrono::milliseconds{due})};
+  }
+
+  /**
+   * Returns the number of write transactions `claim()` has opened.
+   */
+  std::size_t polls() const noexcept {
+    return _polls.load();
+  }
+
+  /**
+   * Schedules a job to become due at `due`.
+   *
+   * @returns the job's ID
+   * @throws lmdb::error on failure
+   */
+  std::uint64_t schedule(MDB_txn* const txn,
+                         const std::string_view payload,
+                         const clock::time_point due) {
+    lmdb::dbi leases{_leases};
+    const std::string counter = id_key(0);
+    std::string_view v;
+    const std::uint64_t id = (leases.get(txn, counter, v) && v.size() == 8) ? detail::get_be64(v) : 1;
+    leases.put(txn, counter, id_key(id + 1));
+
+    const std::uint64_t due_ms = to_millis(due);
+    lmdb::dbi{_jobs}.put(txn, job_key(due_ms, id), payload);
+    lower_next_due(due_ms); /* harmless if the transaction is aborted */
+    return id;
+  }
+
+  /**
+   * Schedules a job to become due `delay` from now.
+   *
+   * @returns the job's ID
+   * @throws lmdb::error on failure
+   */
+  template<class Rep, class Period>
+  std::uint64_t schedule(MDB_txn* const txn,
+                         const std::string_view payload,
+                         const std::chrono::duration<Rep, Period> delay) {
+    return schedule(txn, payload, clock::now() + std::chrono::duration_cast<clock::duration>(delay));
+  }
+
+  /**
+   * Claims up to `max` due jobs in one write transaction, leasing each of
+   * them for `lease`. Returns without opening a transaction if no job is
+   * known to be due.
+   *
+   * @throws lmdb::error on failure
+   */
+  template<class Rep, class Period>
+  std::vector<delay_job> claim(const std::size_t max,
+                               const std::chrono::duration<Rep, Period> lease,
+                               const clock::time_point now = clock::now()) {
+    std::vector<delay_job> result;
+    const std::uint64_t now_ms = to_millis(now);
+    const std::uint64_t next = _next_due.load();
+    if (next != unknown && next > now_ms && now_ms < _last_poll.load() + _refresh_ms.load()) return result;
+
+    ++_polls;
+    _last_poll = now_ms;
+    const std::uint64_t until = now_ms + static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(lease).count());
+    auto txn = lmdb::txn::begin(_env);
+    try {
+      lmdb::dbi jobs{_jobs}, leases{_leases};
+      {
+        auto cursor = lmdb::cursor::open(txn, _jobs);
+        std::string_view k, v;
+        for (bool found = cursor.get(k, v, MDB_FIRST); found && result.size() < max; found = cursor.get(k, v, MDB_NEXT)) {
+          if (k.size() != 16 || detail::get_be64(k) > now_ms) break;
+          result.push_back({detail::get_be64(k.substr(8)), 0, 1, std::string{v}});
+          cursor.del();
+        }
+      }
+      for (auto& job : result) {
+        std::string_view l;
+        const std::string id = id_key(job.id);
+        if (leases.get(txn, id, l) && l.size() == 24) job.attempts = detail::get_be64(l.substr(16)) + 1;
+        job.token = new_token();
+        jobs.put(txn, job_key(until, job.id), job.payload);
+        leases.put(txn, id, lease_record(until, job.token, job.attempts));
+      }
+      {
+        /* Refresh the cache while still holding the writer lock, so that no
+           concurrent schedule() can be missed. */
+        auto cursor = lmdb::cursor::open(txn, _jobs);
+        std::string_view k, v;
+        _next_due = (cursor.get(k, v, MDB_FIRST) && k.size() == 16) ? detail::get_be64(k) : never;
+      } /* the cursor must be closed before the commit */
+      txn.commit();
+    } catch (...) {
+      _next_due = unknown;
+      throw;
+    }
+    return result;
+  }
+
+  /**
+   * Completes a claimed job, deleting it, if `token` still holds its lease.
+   *
+   * @retval true  if the job was deleted
+   * @retval false if the lease was lost (the job was claimed again or acked)
+   * @throws lmdb::error on failure
+   */
+  bool ack(MDB_txn* const txn,
+           const std::uint64_t id,
+           const std::uint64_t token) {
+    lmdb::dbi leases{_leases};
+    const std::string key = id_key(id);
+    std::string_view l;
+    if (!leases.get(txn, key, l) || l.size() != 24 || detail::get_be64(l.substr(8)) != token) return false;
+    const std::uint64_t due = detail::get_be64(l);
+    lmdb::dbi{_jobs}.del(txn, job_key(due, id));
+    leases.del(txn, key);
+    return true;
+  }
+
+  /**
+   * Returns the number of pending jobs (due, not yet due, or leased).
+   *
+   * @throws lmdb::error on failure
+   */
+  std::size_t size(MDB_txn* const txn) const {
+    return lmdb::dbi{_jobs}.size(txn);
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_DELAY_QUEUE_H */
@@ -0,0 +1,138 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_DELTA_H
+#define LMDBXX_DELTA_H
+
+/**
+ * <lmdbxx/delta.h> - Sorted change-set application for lmdb++.
+ *
+ * Applying a sorted stream of upserts and deletes through `dbi::put()` and
+ * `dbi::del()` descends the B+ tree from the root for every key.
+ * `lmdb::apply_sorted()` instead walks one cursor forward alongside the
+ * stream. It steps with `MDB_NEXT` while the next change is close by and
+ * only re-seeks with `MDB_SET_RANGE` across larger gaps, then writes at the
+ * cursor's position. Keys past the end of the database are written with
+ * `MDB_APPEND`.
+ */
+
+#include "lmdb++.h"
+
+#include <cstddef>     /* for std::size_t */
+#include <optional>    /* for std::optional */
+#include <string>      /* for std::string */
+#include <string_view> /* for std::string_view */
+
+namespace lmdb {
+  struct delta;
+  struct apply_stats;
+
+  template<class Iterator>
+  static apply_stats apply_sorted(MDB_txn* txn, MDB_dbi dbi, Iterator first, Iterator last,
+                                  std::size_t max_steps = 8);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Sorted Deltas */
+
+/**
+ * One change: an upsert of `val` under `key`, or a delete if `val` is empty.
+ */
+struct lmdb::delta {
+  std::string_view key;
+  std::optional<std::string_view> val;
+};
+
+/**
+ * Counters returned by `lmdb::apply_sorted()`.
+ */
+struct lmdb::apply_stats {
+  std::size_t puts{0};    /**< records inserted or overwritten */
+  std::size_t deletes{0}; /**< records deleted (absent keys are not counted) */
+  std::size_t steps{0};   /**< cursor `MDB_NEXT` moves */
+  std::size_t seeks{0};   /**< cursor `MDB_SET_RANGE` lookups */
+};
+
+/**
+ * Applies a sorted sequence of changes to a database with a single cursor.
+ *
+ * The elements of `[first, last)` must have a `key` convertible to
+ * `std::string_view` and a `val` that is a `std::optional<std::string_view>`
+ * (see `lmdb::delta`). Keys must be in the database's key order. A key that
+ * appears more than once is applied in sequence, so the last change wins.
+ * Out-of-order keys past the end of the database raise `MDB_KEYEXIST`.
+ *
+ * @param txn a write transaction handle
+ * @param dbi the database (not `MDB_DUPSORT`)
+ * @param first
+ * @param last
+ * @param max_steps how many records the cursor steps over before it re-seeks
+ * @throws lmdb::error on failure
+ */
+template<class Iterator>
+static lmdb::apply_stats
+lmdb::apply_sorted(MDB_txn* const txn,
+                   const MDB_dbi dbi,
+                   Iterator first,
+                   const Iterator last,
+                   const std::size_t max_steps) {
+  enum class position {
+    none,    /* not positioned yet */
+    fresh,   /* on the record in `ck` */
+    written, /* on a record just written; `ck` is stale */
+    deleted, /* just before the successor of a deleted record */
+    end,     /* past the last record */
+  };
+
+  apply_stats stats;
+  auto cursor = lmdb::cursor::open(txn, dbi);
+  auto state = position::none;
+  MDB_val ck{}, cv{};
+
+  const auto compare = [&](const MDB_val& a, const std::string_view b) {
+    const MDB_val bv{b.size(), const_cast<char*>(b.data())};
+    return lmdb::dbi_cmp(txn, dbi, &a, &bv);
+  };
+  const auto step = [&] {
+    ++stats.steps;
+    state = lmdb::cursor_get(cursor, &ck, &cv, MDB_NEXT) ? position::fresh : position::end;
+  };
+
+  for (; first != last; ++first) {
+    const std::string_view key{first->key};
+    const std::optional<std::string_view>& val = first->val;
+
+    /* Move the cursor to the first record not less than `key`. */
+    if (state == position::written) {
+      state = lmdb::cursor_get(cursor, &ck, &cv, MDB_GET_CURRENT) ? position::fresh : position::end;
+    } else if (state == position::deleted) {
+      step();
+    }
+    for (std::size_t n = 0; state == position::fresh && n < max_steps && compare(ck, key) < 0; ++n) step();
+    if (state == position::none || (state == position::fresh && compare(ck, key) < 0)) {
+      ++stats.seeks;
+      ck = MDB_val{key.size(), const_cast<char*>(key.data())};
+      state = lmdb::cursor_get(cursor, &ck, &cv, MDB_SET_RANGE) ? position::fresh : position::end;
+    }
+
+    const bool exists = state == position::fresh && compare(ck, key) == 0;
+    if (val) {
+      MDB_val kv{key.size(), const_cast<char*>(key.data())};
+      MDB_val vv{val->size(), const_cast<char*>(val->data())};
+      const unsigned int flags = exists ? MDB_CURRENT : (state == position::end ? MDB_APPEND : 0);
+      if (!lmdb::cursor_put(cursor, &kv, &vv, flags)) {
+        error::raise("apply_sorted: keys out of order", MDB_KEYEXIST); /* from MDB_APPEND */
+      }
+      ++stats.puts;
+      state = position::written;
+    } else if (exists) {
+      cursor.del();
+      ++stats.deletes;
+      state = position::deleted;
+    }
+  }
+  return stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_DELTA_H */
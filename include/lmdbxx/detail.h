@@ -0,0 +1,147 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_DETAIL_H
+#define LMDBXX_DETAIL_H
+
+/**
+ * <lmdbxx/detail.h> - Internal helpers shared by the lmdb++ extension headers.
+ *
+ * Nothing in here is part of the public interface; it may change at any time.
+ */
+
+#include "lmdb++.h"
+
+#include <cstdint>     /* for std::uint32_t, std::uint64_t */
+#include <string>      /* for std::string */
+#include <string_view> /* for std::string_view */
+
+////////////////////////////////////////////////////////////////////////////////
+/* Encoding */
+
+namespace lmdb::detail {
+  static inline void put_varint(std::string& out, std::uint64_t value);
+  static inline bool get_varint(std::string_view& in, std::uint64_t& value) noexcept;
+  static inline void put_bytes(std::string& out, std::string_view bytes);
+  static inline bool get_bytes(std::string_view& in, std::string_view& bytes) noexcept;
+  static inline std::uint32_t checksum(std::string_view bytes) noexcept;
+  static inline std::uint64_t hash64(std::string_view bytes) noexcept;
+  static inline void put_be64(std::string& out, std::uint64_t value);
+  static inline std::uint64_t get_be64(std::string_view in) noexcept;
+}
+
+/**
+ * Appends `value` as an unsigned LEB128 varint.
+ */
+static inline void
+lmdb::detail::put_varint(std::string& out,
+                         std::uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+/**
+ * Consumes an unsigned LEB128 varint from the front of `in`.
+ *
+ * @retval true  if a complete varint was decoded
+ * @retval false if `in` was truncated or malformed (and is left untouched)
+ */
+static inline bool
+lmdb::detail::get_varint(std::string_view& in,
+                         std::uint64_t& value) noexcept {
+  std::uint64_t result = 0;
+  for (std::size_t i = 0; i < in.size() && i < 10; ++i) {
+    const auto byte = static_cast<unsigned char>(in[i]);
+    result |= static_cast<std::uint64_t>(byte & 0x7F) << (7 * i);
+    if (!(byte & 0x80)) {
+      value = result;
+      in.remove_prefix(i + 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Appends a length-prefixed byte string.
+ */
+static inline void
+lmdb::detail::put_bytes(std::string& out,
+                        const std::string_view bytes) {
+  put_varint(out, bytes.size());
+  out.append(bytes.data(), bytes.size());
+}
+
+/**
+ * Consumes a length-prefixed byte string from the front of `in`.
+ *
+ * @retval true  if a complete byte string was decoded
+ * @retval false if `in` was truncated (and is left untouched)
+ */
+static inline bool
+lmdb::detail::get_bytes(std::string_view& in,
+                        std::string_view& bytes) noexcept {
+  std::string_view rest = in;
+  std::uint64_t size;
+  if (!get_varint(rest, size) || size > rest.size()) return false;
+  bytes = rest.substr(0, size);
+  rest.remove_prefix(size);
+  in = rest;
+  return true;
+}
+
+/**
+ * 32-bit FNV-1a checksum, used to detect torn or corrupted records.
+ */
+static inline std::uint32_t
+lmdb::detail::checksum(const std::string_view bytes) noexcept {
+  std::uint32_t hash = 2166136261u;
+  for (const char c : bytes) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * 64-bit FNV-1a hash, used where collisions must be practically impossible.
+ */
+static inline std::uint64_t
+lmdb::detail::hash64(const std::string_view bytes) noexcept {
+  std::uint64_t hash = 14695981039346656037ull;
+  for (const char c : bytes) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+/**
+ * Appends `value` as 8 big-endian bytes, so that byte order is numeric order.
+ */
+static inline void
+lmdb::detail::put_be64(std::string& out,
+                       const std::uint64_t value) {
+  for (int shift = 56; shift >= 0; shift -= 8) {
+    out.push_back(static_cast<char>((value >> shift) & 0xFF));
+  }
+}
+
+/**
+ * Decodes the 8 big-endian bytes at the front of `in` (which must hold at
+ * least 8 bytes).
+ */
+static inline std::uint64_t
+lmdb::detail::get_be64(const std::string_view in) noexcept {
+  std::uint64_t value = 0;
+  for (std::size_t i = 0; i < 8; ++i) {
+    value = (value << 8) | static_cast<unsigned char>(in[i]);
+  }
+  return value;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_DETAIL_H */
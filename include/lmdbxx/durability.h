@@ -0,0 +1,216 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_DURABILITY_H
+#define LMDBXX_DURABILITY_H
+
+/**
+ * <lmdbxx/durability.h> - Group fsync with per-commit acknowledgement for lmdb++.
+ *
+ * With `MDB_NOSYNC`, commits are fast but not durable until the next
+ * `mdb_env_sync()`. `lmdb::durability_manager` runs those syncs on a
+ * background thread, either every `interval` or as soon as enough bytes
+ * have been committed. Callers get a future that becomes ready once their
+ * transaction is on disk. Many commits thus share one fsync, and each caller
+ * still knows exactly when its own write is durable.
+ */
+
+#include "lmdb++.h"
+#include "periodic.h"
+
+#include <algorithm>   /* for std::max(), std::min() */
+#include <chrono>      /* for std::chrono::* */
+#include <cstdint>     /* for std::uint64_t */
+#include <future>      /* for std::future, std::promise */
+#include <map>         /* for std::multimap */
+#include <mutex>       /* for std::mutex, std::lock_guard */
+#include <vector>      /* for std::vector */
+
+namespace lmdb {
+  class durability_manager;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Durability Manager */
+
+/**
+ * Background `mdb_env_sync()` flusher with per-transaction durability futures.
+ *
+ * The constructor turns on `MDB_NOSYNC` for the environment. The destructor
+ * stops the thread and performs a final sync; `MDB_NOSYNC` stays on.
+ *
+ * @note Instances of this class are neither copyable nor movable.
+ */
+class lmdb::durability_manager {
+protected:
+  MDB_env* _env;
+  mutable std::mutex _mutex;
+  std::uint64_t _durable{0};
+  std::size_t _dirty{0};
+  std::size_t _dirty_threshold{0};
+  std::multimap<std::uint64_t, std::promise<void>> _waiters;
+  std::size_t _syncs{0};
+  periodic_task _task;
+
+public:
+  /**
+   * Constructor. Enables `MDB_NOSYNC` on `env`.
+   *
+   * @param env the environment
+   * @throws lmdb::error on failure
+   */
+  explicit durability_manager(MDB_env* const env)
+    : _env{env} {
+    lmdb::env_set_flags(env, MDB_NOSYNC, true);
+    MDB_envinfo info;
+    lmdb::env_info(env, &info);
+    _durable = info.me_last_txnid; /* assume what is already there is durable */
+  }
+
+  durability_manager(const durability_manager&) = delete;
+  durability_manager& operator=(const durability_manager&) = delete;
+
+  /**
+   * Destructor. Stops the background thread and syncs one last time.
+   */
+  ~durability_manager() noexcept {
+    stop();
+    try { sync(); } catch (...) {}
+  }
+
+  /**
+   * Starts syncing every `interval` on a background thread.
+   */
+  template<class Rep, class Period>
+  void start(const std::chrono::duration<Rep, Period> interval) {
+    _task.start(interval, [this] { sync(); });
+  }
+
+  /**
+   * Stops the background thread.
+   *
+   * @note this method is idempotent
+   */
+  void stop() noexcept {
+    _task.stop();
+  }
+
+  /**
+   * Syncs early once `bytes` have been committed since the last sync (zero
+   * disables the threshold). The sizes passed to `commit()` and
+   * `note_commit()` are what is counted.
+   */
+  durability_manager& set_dirty_threshold(const std::size_t bytes) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _dirty_threshold = bytes;
+    return *this;
+  }
+
+  /**
+   * Returns the ID of the last transaction known to be durable.
+   */
+  std::uint64_t durable_txnid() const {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _durable;
+  }
+
+  /**
+   * Returns the number of syncs performed so far.
+   */
+  std::size_t syncs() const {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _syncs;
+  }
+
+  /**
+   * Returns the most recent exception thrown by a background sync, if any.
+   */
+  std::exception_ptr last_error() const {
+    return _task.last_error();
+  }
+
+  /**
+   * Returns a future that becomes ready once transaction `txnid` is durable,
+   * or that holds the error if a sync fails first.
+   */
+  std::future<void> wait_durable(const std::uint64_t txnid) {
+    std::promise<void> promise;
+    auto result = promise.get_future();
+    std::lock_guard<std::mutex> lock{_mutex};
+    if (txnid <= _durable) promise.set_value();
+    else _waiters.emplace(txnid, std::move(promise));
+    return result;
+  }
+
+  /**
+   * Accounts for `bytes` of committed data, waking the flusher if the
+   * dirty threshold has been reached.
+   */
+  void note_commit(const std::size_t bytes) {
+    bool wake;
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _dirty += bytes;
+      wake = _dirty_threshold && _dirty >= _dirty_threshold;
+    }
+    if (wake) _task.wake();
+  }
+
+  /**
+   * Commits a write transaction of this environment and returns a future
+   * that becomes ready once it is durable.
+   *
+   * @param txn a write transaction
+   * @param bytes approximate size of its changes (e.g. the key and value
+   *        bytes written), counted towards the dirty threshold
+   * @throws lmdb::error if the commit fails
+   */
+  std::future<void> commit(lmdb::txn& txn,
+                           const std::size_t bytes) {
+    /* While the write transaction is open nobody else can commit, so it
+       will be assigned the next ID (unless it turns out to be empty). */
+    MDB_envinfo info;
+    lmdb::env_info(_env, &info);
+    std::uint64_t id = info.me_last_txnid + 1;
+    txn.commit();
+    lmdb::env_info(_env, &info);
+    id = std::min<std::uint64_t>(id, info.me_last_txnid);
+    note_commit(bytes);
+    return wait_durable(id);
+  }
+
+  /**
+   * Flushes the environment to disk now and completes the futures of every
+   * transaction committed before the call.
+   *
+   * @throws lmdb::error on failure (the pending futures receive it as well)
+   */
+  void sync() {
+    MDB_envinfo info;
+    lmdb::env_info(_env, &info);
+    const std::uint64_t target = info.me_last_txnid;
+
+    std::vector<std::promise<void>> ready;
+    try {
+      lmdb::env_sync(_env, true);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock{_mutex};
+      for (auto& w : _waiters) w.second.set_exception(std::current_exception());
+      _waiters.clear();
+      throw;
+    }
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _durable = std::max(_durable, target);
+      _dirty = 0;
+      ++_syncs;
+      const auto end = _waiters.upper_bound(_durable);
+      for (auto it = _waiters.begin(); it != end; ++it) ready.push_back(std::move(it->second));
+      _waiters.erase(_waiters.begin(), end);
+    }
+    for (auto& p : ready) p.set_value();
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_DURABILITY_H */
@@ -0,0 +1,199 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_HASHED_H
+#define LMDBXX_HASHED_H
+
+/**
+ * <lmdbxx/hashed.h> - Hash-keyed point-lookup databases for lmdb++.
+ *
+ * Long keys make every branch-page comparison a long `memcmp()` and leave
+ * room for few keys per page. `lmdb::hashed_dbi` stores each record under a
+ * machine-word hash of its key instead, in an `MDB_INTEGERKEY | MDB_DUPSORT`
+ * database. Branch pages then hold short integer keys, so the tree is wider
+ * and shallower, and comparisons are single integer compares. The full key
+ * is kept at the front of the value and resolves hash collisions among the
+ * duplicates.
+ */
+
+#include "lmdb++.h"
+#include "detail.h"
+
+#include <cstddef>     /* for std::size_t */
+#include <string>      /* for std::string */
+#include <string_view> /* for std::string_view */
+
+namespace lmdb {
+  class hashed_dbi;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Hashed Databases */
+
+/**
+ * A database of records stored under the hash of their key.
+ *
+ * Each record is a duplicate of the key `hash64(key)`, truncated to
+ * `std::size_t` as `MDB_INTEGERKEY` requires. Its data is the key's length
+ * as a varint, then the key, then the value. A lookup positions on the hash
+ * and uses `MDB_GET_BOTH_RANGE` with the length-prefixed key, which finds
+ * the record among colliding duplicates without scanning them.
+ *
+ * Keys are unordered, so this suits point lookups only. Like all
+ * `MDB_DUPSORT` data, a record's key plus value must fit in
+ * `mdb_env_get_maxkeysize()` bytes (511 by default).
+ *
+ * @note Instances of this class are copyable and movable.
+ */
+class lmdb::hashed_dbi {
+protected:
+  MDB_dbi _handle{};
+
+  static std::size_t hash(const std::string_view key) noexcept {
+    return static_cast<std::size_t>(detail::hash64(key));
+  }
+
+  static std::string_view hash_key(const std::size_t& h) noexcept {
+    return {reinterpret_cast<const char*>(&h), sizeof(h)};
+  }
+
+  static std::string prefix(const std::string_view key) {
+    std::string result;
+    detail::put_bytes(result, key);
+    return result;
+  }
+
+  /* Positions `cursor` on the record of `key`, returning its value. */
+  static bool find(lmdb::cursor& cursor,
+                   const std::size_t& h,
+                   const std::string& pfx,
+                   std::string_view& val) {
+    std::string_view k = hash_key(h), v{pfx};
+    if (!cursor.get(k, v, MDB_GET_BOTH_RANGE)) return false;
+    if (v.substr(0, pfx.size()) != pfx) return false;
+    val = v.substr(pfx.size());
+    return true;
+  }
+
+public:
+  static constexpr unsigned int default_flags     = 0;
+  static constexpr unsigned int default_put_flags = 0;
+
+  /**
+   * Opens a hashed database handle. `MDB_INTEGERKEY | MDB_DUPSORT` is
+   * added to `flags`.
+   *
+   * @param txn the transaction handle
+   * @param name the database name, or nullptr
+   * @param flags dbi flags, ie MDB_CREATE
+   * @throws lmdb::error on failure
+   */
+  static hashed_dbi
+  open(MDB_txn* const txn,
+       const char* const name = nullptr,
+       const unsigned int flags = default_flags) {
+    return hashed_dbi{lmdb::dbi::open(txn, name, flags | MDB_INTEGERKEY | MDB_DUPSORT)};
+  }
+
+  /**
+   * Constructor.
+   *
+   * @note Creates an uninitialized instance. Assign the result of `open()`
+   *       onto it before using it.
+   */
+  hashed_dbi() noexcept = default;
+
+  /**
+   * Constructor.
+   *
+   * @param handle a valid `MDB_dbi` handle opened with
+   *        `MDB_INTEGERKEY | MDB_DUPSORT`
+   */
+  explicit hashed_dbi(const MDB_dbi handle) noexcept
+    : _handle{handle} {}
+
+  /**
+   * Returns the underlying `MDB_dbi` handle.
+   */
+  operator MDB_dbi() const noexcept {
+    return _handle;
+  }
+
+  /**
+   * Returns the underlying `MDB_dbi` handle.
+   */
+  MDB_dbi handle() const noexcept {
+    return _handle;
+  }
+
+  /**
+   * Returns the number of records in this database.
+   *
+   * @param txn a transaction handle
+   * @throws lmdb::error on failure
+   */
+  std::size_t size(MDB_txn* const txn) const {
+    return lmdb::dbi{_handle}.size(txn);
+  }
+
+  /**
+   * Retrieves a key/value pair from this database.
+   *
+   * @param txn a transaction handle
+   * @param key
+   * @param data
+   * @throws lmdb::error on failure
+   */
+  bool get(MDB_txn* const txn,
+           const std::string_view key,
+           std::string_view& data) const {
+    auto cursor = lmdb::cursor::open(txn, _handle);
+    return find(cursor, hash(key), prefix(key), data);
+  }
+
+  /**
+   * Stores a key/value pair into this database, replacing any previous
+   * value of the key.
+   *
+   * @param txn a transaction handle
+   * @param key
+   * @param data
+   * @param flags `MDB_NOOVERWRITE` or 0
+   * @retval false if the key exists and `MDB_NOOVERWRITE` was given
+   * @throws lmdb::error on failure
+   */
+  bool put(MDB_txn* const txn,
+           const std::string_view key,
+           const std::string_view data,
+           const unsigned int flags = default_put_flags) {
+    const std::size_t h = hash(key);
+    std::string record = prefix(key);
+    auto cursor = lmdb::cursor::open(txn, _handle);
+    std::string_view old;
+    if (find(cursor, h, record, old)) {
+      if (flags & MDB_NOOVERWRITE) return false;
+      cursor.del(); /* a different value sorts elsewhere among the duplicates */
+    }
+    record.append(data.data(), data.size());
+    return cursor.put(hash_key(h), record, flags & ~static_cast<unsigned int>(MDB_NOOVERWRITE));
+  }
+
+  /**
+   * Removes a key from this database.
+   *
+   * @param txn a transaction handle
+   * @param key
+   * @throws lmdb::error on failure
+   */
+  bool del(MDB_txn* const txn,
+           const std::string_view key) {
+    auto cursor = lmdb::cursor::open(txn, _handle);
+    std::string_view old;
+    if (!find(cursor, hash(key), prefix(key), old)) return false;
+    cursor.del();
+    return true;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_HASHED_H */
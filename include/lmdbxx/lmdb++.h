@@ -26,14 +26,17 @@
 #ifdef LMDBXX_DEBUG
 #include <cassert>     /* for assert() */
 #endif
-#include <cstddef>     /* for std::size_t */
+#include <cstddef>     /* for std::size_t, std::max_align_t */
+#include <cstdint>     /* for std::uintptr_t */
 #include <cstdio>      /* for std::snprintf() */
-#include <cstring>     /* for std::memcpy() */
+#include <cstring>     /* for std::memcpy(), std::memset() */
 #include <stdexcept>   /* for std::runtime_error */
 #include <string>      /* for std::string */
 #include <string_view> /* for std::string_view */
 #include <limits>      /* for std::numeric_limits<> */
 #include <memory>      /* for std::addressof */
+#include <optional>    /* for std::optional */
+#include <type_traits> /* for std::is_trivially_copyable_v<> */
 
 namespace lmdb {
   using mode = mdb_mode_t;
@@ -256,7 +259,7 @@ namespace lmdb {
   static inline void* env_get_userctx(MDB_env* env);
 #endif
   // TODO: mdb_env_set_assert()
-  // TODO: mdb_reader_list()
+  static inline void reader_list(MDB_env* env, MDB_msg_func* func, void* ctx);
   static inline void reader_check(MDB_env *env, int *dead);
 }
 
@@ -518,6 +521,24 @@ lmdb::env_get_userctx(MDB_env* const env) {
 }
 #endif
 
+/**
+ * @throws lmdb::error on failure
+ * @see http://symas.com/mdb/doc/group__mdb.html
+ */
+static inline void
+lmdb::reader_list(MDB_env* const env,
+                  MDB_msg_func* const func,
+                  void* const ctx) {
+  const int rc = ::mdb_reader_list(env, func, ctx);
+  if (rc < 0) {
+    error::raise("mdb_reader_list", rc);
+  }
+}
+
+/**
+ * @throws lmdb::error on failure
+ * @see http://symas.com/mdb/doc/group__mdb.html
+ */
 static inline void
 lmdb::reader_check(MDB_env *env, int *dead) {
   const int rc = ::mdb_reader_check(env, dead);
@@ -632,8 +653,8 @@ namespace lmdb {
   static inline bool dbi_get(MDB_txn* txn, MDB_dbi dbi, const MDB_val* key, MDB_val* data);
   static inline bool dbi_put(MDB_txn* txn, MDB_dbi dbi, const MDB_val* key, MDB_val* data, unsigned int flags);
   static inline bool dbi_del(MDB_txn* txn, MDB_dbi dbi, const MDB_val* key, const MDB_val* data);
-  // TODO: mdb_cmp()
-  // TODO: mdb_dcmp()
+  static inline int dbi_cmp(MDB_txn* txn, MDB_dbi dbi, const MDB_val* a, const MDB_val* b) noexcept;
+  static inline int dbi_dcmp(MDB_txn* txn, MDB_dbi dbi, const MDB_val* a, const MDB_val* b) noexcept;
 }
 
 /**
@@ -809,6 +830,32 @@ lmdb::dbi_del(MDB_txn* const txn,
   return (rc == MDB_SUCCESS);
 }
 
+/**
+ * Compares two keys using the database's key comparison function.
+ *
+ * @see http://symas.com/mdb/doc/group__mdb.html
+ */
+static inline int
+lmdb::dbi_cmp(MDB_txn* const txn,
+              const MDB_dbi dbi,
+              const MDB_val* const a,
+              const MDB_val* const b) noexcept {
+  return ::mdb_cmp(txn, dbi, a, b);
+}
+
+/**
+ * Compares two data items using the database's duplicate comparison function.
+ *
+ * @see http://symas.com/mdb/doc/group__mdb.html
+ */
+static inline int
+lmdb::dbi_dcmp(MDB_txn* const txn,
+               const MDB_dbi dbi,
+               const MDB_val* const a,
+               const MDB_val* const b) noexcept {
+  return ::mdb_dcmp(txn, dbi, a, b);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /* Procedural Interface: Cursors */
 
@@ -1106,6 +1153,28 @@ public:
     return *this;
   }
 
+  /**
+   * Returns information about this environment.
+   *
+   * @throws lmdb::error on failure
+   */
+  MDB_envinfo info() const {
+    MDB_envinfo result;
+    lmdb::env_info(handle(), &result);
+    return result;
+  }
+
+  /**
+   * Returns statistics for this environment's main database.
+   *
+   * @throws lmdb::error on failure
+   */
+  MDB_stat stat() const {
+    MDB_stat result;
+    lmdb::env_stat(handle(), &result);
+    return result;
+  }
+
   mdb_filehandle_t get_fd() {
     mdb_filehandle_t fd;
     lmdb::env_get_fd(handle(), &fd);
@@ -1270,6 +1339,9 @@ public:
 
 namespace lmdb {
   class dbi;
+
+  template<typename T>
+  static inline const T* aligned_from_record(std::string_view v, T& copy);
 }
 
 /**
@@ -1281,6 +1353,14 @@ class lmdb::dbi {
 protected:
   MDB_dbi _handle{(std::numeric_limits<MDB_dbi>::max)()};
 
+  /* Adapts a stateless comparator type to the `MDB_cmp_func` signature. */
+  template<class Comparator>
+  static int compare_trampoline(const MDB_val* const a,
+                                const MDB_val* const b) {
+    return Comparator{}(std::string_view{static_cast<const char*>(a->mv_data), a->mv_size},
+                        std::string_view{static_cast<const char*>(b->mv_data), b->mv_size});
+  }
+
 public:
   static constexpr unsigned int default_flags     = 0;
   static constexpr unsigned int default_put_flags = 0;
@@ -1415,6 +1495,22 @@ public:
     return *this;
   }
 
+  /**
+   * Sets a custom key comparison for this database from a comparator type,
+   * such as those in `<lmdbxx/comparators.h>`. `Comparator` must be default
+   * constructible and callable as `int(std::string_view, std::string_view)`.
+   * Each instantiation gets its own static function, so LMDB calls the
+   * comparator directly and its body can be inlined there.
+   *
+   * @param txn a transaction handle
+   * @throws lmdb::error on failure
+   */
+  template<class Comparator>
+  dbi& set_compare(MDB_txn* const txn) {
+    lmdb::dbi_set_compare(txn, handle(), &compare_trampoline<Comparator>);
+    return *this;
+  }
+
   /**
    * Retrieves a key/value pair from this database.
    *
@@ -1482,6 +1578,221 @@ public:
     const MDB_val valV{val.size(), const_cast<char*>(val.data())};
     return lmdb::dbi_del(txn, handle(), &keyV, &valV);
   }
+
+  /**
+   * Replaces the value stored under a key with `op(old)`, where `old` is the
+   * current value or `std::nullopt` if the key is absent. The key is looked
+   * up once: an existing record is rewritten at the cursor position with
+   * `MDB_CURRENT`, which LMDB does in place if the size is unchanged.
+   *
+   * @param txn a write transaction handle
+   * @param key
+   * @param op called as `op(std::optional<std::string_view>)`; returns the new
+   *           value as anything convertible to `std::string_view` that stays
+   *           valid until the write (e.g. a `std::string`)
+   * @returns whether the key existed
+   * @warning Not for `MDB_DUPSORT` databases.
+   * @throws lmdb::error on failure
+   */
+  template<class F>
+  bool merge(MDB_txn* const txn,
+             const std::string_view key,
+             F&& op) {
+    MDB_cursor* cursor{};
+    lmdb::cursor_open(txn, handle(), &cursor);
+    try {
+      MDB_val keyV{key.size(), const_cast<char*>(key.data())};
+      MDB_val valV{};
+      const bool found = lmdb::cursor_get(cursor, &keyV, &valV, MDB_SET_KEY);
+      std::optional<std::string_view> old;
+      if (found) old.emplace(static_cast<char*>(valV.mv_data), valV.mv_size);
+      const auto result = op(old);
+      const std::string_view data{result};
+      MDB_val newKeyV{key.size(), const_cast<char*>(key.data())};
+      MDB_val newValV{data.size(), const_cast<char*>(data.data())};
+      lmdb::cursor_put(cursor, &newKeyV, &newValV, found ? MDB_CURRENT : 0);
+      lmdb::cursor_close(cursor);
+      return found;
+    } catch (...) {
+      lmdb::cursor_close(cursor);
+      throw;
+    }
+  }
+
+  /**
+   * Stores `desired` under a key only if its current value equals
+   * `expected` (or, if `expected` is `std::nullopt`, only if the key is
+   * absent). Like `merge()`, this looks the key up once.
+   *
+   * @param txn a write transaction handle
+   * @param key
+   * @param expected
+   * @param desired
+   * @returns whether the value was swapped
+   * @warning Not for `MDB_DUPSORT` databases.
+   * @throws lmdb::error on failure
+   */
+  bool compare_and_swap(MDB_txn* const txn,
+                        const std::string_view key,
+                        const std::optional<std::string_view> expected,
+                        const std::string_view desired) {
+    MDB_cursor* cursor{};
+    lmdb::cursor_open(txn, handle(), &cursor);
+    try {
+      MDB_val keyV{key.size(), const_cast<char*>(key.data())};
+      MDB_val valV{};
+      const bool found = lmdb::cursor_get(cursor, &keyV, &valV, MDB_SET_KEY);
+      bool swap = found == expected.has_value();
+      if (swap && found) {
+        swap = std::string_view{static_cast<char*>(valV.mv_data), valV.mv_size} == *expected;
+      }
+      if (swap) {
+        MDB_val newKeyV{key.size(), const_cast<char*>(key.data())};
+        MDB_val newValV{desired.size(), const_cast<char*>(desired.data())};
+        lmdb::cursor_put(cursor, &newKeyV, &newValV, found ? MDB_CURRENT : 0);
+      }
+      lmdb::cursor_close(cursor);
+      return swap;
+    } catch (...) {
+      lmdb::cursor_close(cursor);
+      throw;
+    }
+  }
+
+  /**
+   * Retrieves a writable pointer to an existing value, for editing it in
+   * place without changing its size. The record is rewritten with
+   * `MDB_CURRENT|MDB_RESERVE`, which makes its page dirty (copy-on-write)
+   * and returns the value's new location. The old contents are carried
+   * over. Under `MDB_WRITEMAP` the edits go straight to the map.
+   *
+   * @param txn a write transaction handle
+   * @param key
+   * @param data receives a pointer to the value's bytes
+   * @param size receives the value's size
+   * @retval true  if the key was found
+   * @retval false if the key was not found
+   * @warning The pointer is invalidated by the next write in `txn` and by
+   *          its end. It is not necessarily aligned. Raises `EINVAL` for
+   *          `MDB_DUPSORT` databases.
+   * @throws lmdb::error on failure
+   */
+  bool get_writable(MDB_txn* const txn,
+                    const std::string_view key,
+                    char*& data,
+                    std::size_t& size) {
+    if (flags(txn) & MDB_DUPSORT) error::raise("dbi::get_writable", EINVAL);
+    MDB_cursor* cursor{};
+    lmdb::cursor_open(txn, handle(), &cursor);
+    try {
+      MDB_val keyV{key.size(), const_cast<char*>(key.data())};
+      MDB_val oldV{};
+      if (!lmdb::cursor_get(cursor, &keyV, &oldV, MDB_SET_KEY)) {
+        lmdb::cursor_close(cursor);
+        return false;
+      }
+      MDB_val newV{oldV.mv_size, nullptr};
+      lmdb::cursor_put(cursor, &keyV, &newV, MDB_CURRENT | MDB_RESERVE);
+      /* The value moved if its page was not dirty yet. The old copy stays
+         readable until the transaction ends, since LMDB does not reuse the
+         pages freed by a transaction before it commits. */
+      if (newV.mv_data != oldV.mv_data) std::memcpy(newV.mv_data, oldV.mv_data, oldV.mv_size);
+      lmdb::cursor_close(cursor);
+      data = static_cast<char*>(newV.mv_data);
+      size = newV.mv_size;
+      return true;
+    } catch (...) {
+      lmdb::cursor_close(cursor);
+      throw;
+    }
+  }
+
+  /**
+   * Typed variant of `get_writable()` for fixed-size values.
+   *
+   * @returns a pointer to the value, or nullptr if the key was not found
+   * @throws lmdb::error on failure, or with `MDB_BAD_VALSIZE` if the value
+   *         is not `sizeof(T)` bytes
+   */
+  template<typename T>
+  T* get_writable(MDB_txn* const txn,
+                  const std::string_view key) {
+    char* data{};
+    std::size_t size{};
+    if (!get_writable(txn, key, data, size)) return nullptr;
+    if (size != sizeof(T)) error::raise("dbi::get_writable", MDB_BAD_VALSIZE);
+    return reinterpret_cast<T*>(data);
+  }
+
+  /**
+   * Stores `val` as an aligned record. The value is preceded by 1 to
+   * `alignof(T)` padding bytes, each holding the padding length, which put
+   * it on an `alignof(T)` boundary. It is followed by enough zero bytes to
+   * make the record's node a multiple of `alignof(T)` long. The record is
+   * reserved with `MDB_RESERVE`, so the padding is chosen for the address
+   * the value actually lands at, and `val` is copied there directly.
+   *
+   * LMDB packs the nodes of a leaf page back to back from the end of the
+   * page. If every record of the database is written this way, all nodes
+   * keep a length that is a multiple of `alignof(T)`, so values stay
+   * aligned when later writes and page splits move them around.
+   *
+   * Without `MDB_WRITEMAP` the reserved space is in a dirty page allocated
+   * with `malloc()`, whose address is only aligned to
+   * `alignof(std::max_align_t)`. Overflow pages put values 16 bytes past a
+   * page boundary. `alignof(T)` is therefore limited to 16 and to
+   * `alignof(std::max_align_t)`, the alignments that carry over to the map.
+   *
+   * @param txn a write transaction handle
+   * @param key
+   * @param val
+   * @param flags
+   * @retval false if the key exists and `MDB_NOOVERWRITE` was given
+   * @note Not for `MDB_DUPSORT` databases, which do not support
+   *       `MDB_RESERVE`. Read the record with `get_aligned()`.
+   * @throws lmdb::error on failure
+   */
+  template<typename T>
+  bool put_aligned(MDB_txn* const txn,
+                   const std::string_view key,
+                   const T& val,
+                   const unsigned int flags = default_put_flags) {
+    static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable");
+    static_assert(alignof(T) <= 16 && alignof(T) <= alignof(std::max_align_t),
+                  "stricter alignment than malloc()'d dirty pages cannot carry over to the map");
+    constexpr std::size_t align = alignof(T);
+    const std::size_t node = 8 + key.size() + align + sizeof(T); /* 8: LMDB's node header */
+    const std::size_t size = align + sizeof(T) + (align - node % align) % align;
+    const MDB_val keyV{key.size(), const_cast<char*>(key.data())};
+    MDB_val dataV{size, nullptr};
+    if (!lmdb::dbi_put(txn, handle(), &keyV, &dataV, flags | MDB_RESERVE)) return false;
+    char* const data = static_cast<char*>(dataV.mv_data);
+    const std::size_t pad = align - reinterpret_cast<std::uintptr_t>(data) % align;
+    std::memset(data, static_cast<int>(pad), pad);
+    std::memcpy(data + pad, std::addressof(val), sizeof(T));
+    std::memset(data + pad + sizeof(T), 0, size - pad - sizeof(T));
+    return true;
+  }
+
+  /**
+   * Retrieves a record written by `put_aligned()`.
+   *
+   * @param txn a transaction handle
+   * @param key
+   * @param copy receives a copy of the value if it is not aligned in the map
+   * @returns a pointer to the value: into the map if it is aligned there,
+   *          else to `copy`; nullptr if the key was not found
+   * @throws lmdb::error on failure, or with `MDB_BAD_VALSIZE` if the record
+   *         was not written by `put_aligned<T>()`
+   */
+  template<typename T>
+  const T* get_aligned(MDB_txn* const txn,
+                       const std::string_view key,
+                       T& copy) {
+    std::string_view record;
+    if (!get(txn, key, record)) return nullptr;
+    return lmdb::aligned_from_record<T>(record, copy);
+  }
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1706,13 +2017,54 @@ namespace lmdb {
    * Takes a std::string_view and casts its pointer as a pointer to the parameterized type.
    *
    * @param v
+   * @warning LMDB only guarantees 2-byte alignment of values. Use
+   *          `aligned_ptr_from_sv()` or `dbi::get_aligned()` for types
+   *          with stricter alignment.
    */
   template<typename T>
   static inline T* ptr_from_sv(std::string_view v) {
     if (v.size() != sizeof(T)) error::raise("ptr_from_sv", MDB_BAD_VALSIZE);
+#ifdef LMDBXX_DEBUG
+    assert(reinterpret_cast<std::uintptr_t>(v.data()) % alignof(T) == 0);
+#endif
     return reinterpret_cast<T*>(const_cast<char*>(v.data()));
   }
 
+  /**
+   * Takes a std::string_view and returns a pointer to it as the parameterized
+   * type if its data is suitably aligned. Otherwise the data is copied into
+   * `copy`, and a pointer to that is returned.
+   *
+   * @param v
+   * @param copy
+   */
+  template<typename T>
+  static inline const T* aligned_ptr_from_sv(std::string_view v, T& copy) {
+    static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable");
+    if (v.size() != sizeof(T)) error::raise("aligned_ptr_from_sv", MDB_BAD_VALSIZE);
+    if (reinterpret_cast<std::uintptr_t>(v.data()) % alignof(T) == 0) {
+      return reinterpret_cast<const T*>(v.data());
+    }
+    std::memcpy(std::addressof(copy), v.data(), sizeof(T));
+    return std::addressof(copy);
+  }
+
+  /**
+   * Takes a record written by `dbi::put_aligned()` (e.g. read with a cursor)
+   * and returns a pointer to its value, as `aligned_ptr_from_sv()` does.
+   *
+   * @param v
+   * @param copy
+   */
+  template<typename T>
+  static inline const T* aligned_from_record(std::string_view v, T& copy) {
+    const std::size_t pad = v.empty() ? 0 : static_cast<unsigned char>(v[0]);
+    if (pad == 0 || pad > alignof(T) || v.size() < pad + sizeof(T)) {
+      error::raise("aligned_from_record", MDB_BAD_VALSIZE);
+    }
+    return aligned_ptr_from_sv<T>(v.substr(pad, sizeof(T)), copy);
+  }
+
   /**
    * Takes a std::string_view and dereferences it, returning a value of the parameterized type.
    *
@@ -0,0 +1,230 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_MEMTABLE_H
+#define LMDBXX_MEMTABLE_H
+
+/**
+ * <lmdbxx/memtable.h> - Sorted in-memory write buffer for lmdb++.
+ *
+ * Random-key writes copy a different leaf page (plus its branch pages) for
+ * almost every record. `lmdb::memtable` absorbs puts and deletes in a sorted
+ * in-memory map, serves reads by overlaying that map on a read transaction,
+ * and flushes everything in one write transaction in key order. Each page
+ * is then copied once per flush instead of once per record.
+ */
+
+#include "lmdb++.h"
+
+#include <cstddef>          /* for std::size_t */
+#include <functional>       /* for std::less<> */
+#include <map>              /* for std::pmr::map */
+#include <memory_resource>  /* for std::pmr::monotonic_buffer_resource */
+#include <string>           /* for std::pmr::string */
+#include <string_view>      /* for std::string_view */
+
+namespace lmdb {
+  class memtable;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Memtables */
+
+/**
+ * An ordered write buffer in front of one database.
+ *
+ * Keys, values and map nodes are allocated from a monotonic arena, so
+ * buffering costs no per-record `malloc()`/`free()`. The arena is released
+ * all at once when the buffer is flushed. Overwriting a buffered key
+ * leaves its old value in the arena until then.
+ *
+ * @warning Not thread-safe. Not for `MDB_DUPSORT` databases. `scan()`
+ *          assumes the database uses LMDB's default key order.
+ * @note Instances of this class are neither copyable nor movable.
+ */
+class lmdb::memtable {
+public:
+  static constexpr std::size_t default_flush_bytes = 64 << 20;
+
+protected:
+  struct entry {
+    std::pmr::string val;
+    bool deleted;
+  };
+
+  MDB_env* _env;
+  MDB_dbi _dbi;
+  std::size_t _flush_bytes;
+  std::size_t _bytes{0};
+  std::pmr::monotonic_buffer_resource _arena;
+  std::pmr::map<std::pmr::string, entry, std::less<>> _entries{&_arena};
+
+  void record(const std::string_view key,
+              const std::string_view val,
+              const bool deleted) {
+    auto it = _entries.find(key);
+    if (it == _entries.end()) {
+      it = _entries.emplace(std::pmr::string{key, &_arena}, entry{std::pmr::string{&_arena}, false}).first;
+      _bytes += key.size();
+    }
+    it->second.val.assign(val.data(), val.size());
+    it->second.deleted = deleted;
+    _bytes += val.size();
+    if (_flush_bytes && _bytes >= _flush_bytes) flush();
+  }
+
+public:
+  /**
+   * Constructor.
+   *
+   * @param env the environment
+   * @param dbi the database to buffer writes for
+   * @param flush_bytes buffered bytes that trigger an automatic flush
+   *                    (zero: only flush explicitly)
+   */
+  memtable(MDB_env* const env,
+           const MDB_dbi dbi,
+           const std::size_t flush_bytes = default_flush_bytes)
+    : _env{env},
+      _dbi{dbi},
+      _flush_bytes{flush_bytes} {}
+
+  memtable(const memtable&) = delete;
+  memtable& operator=(const memtable&) = delete;
+
+  /**
+   * Returns the number of buffered records (tombstones included).
+   */
+  std::size_t size() const noexcept {
+    return _entries.size();
+  }
+
+  /**
+   * Returns the number of key and value bytes written since the last flush.
+   */
+  std::size_t bytes() const noexcept {
+    return _bytes;
+  }
+
+  /**
+   * Buffers a key/value pair.
+   *
+   * @throws lmdb::error if an automatic flush fails
+   */
+  void put(const std::string_view key,
+           const std::string_view val) {
+    record(key, val, false);
+  }
+
+  /**
+   * Buffers the removal of a key.
+   *
+   * @throws lmdb::error if an automatic flush fails
+   */
+  void del(const std::string_view key) {
+    record(key, {}, true);
+  }
+
+  /**
+   * Retrieves a value, looking in the buffer first and in `txn` second.
+   *
+   * @retval true  if the key was found
+   * @retval false if the key was not found (or is deleted in the buffer)
+   * @throws lmdb::error on failure
+   */
+  bool get(MDB_txn* const txn,
+           const std::string_view key,
+           std::string_view& val) const {
+    const auto it = _entries.find(key);
+    if (it != _entries.end()) {
+      if (it->second.deleted) return false;
+      val = it->second.val;
+      return true;
+    }
+    return lmdb::dbi{_dbi}.get(txn, key, val);
+  }
+
+  /**
+   * Calls `fn(key, val)` for every live key not less than `from`, merging the
+   * buffer with `txn` in key order, until `fn` returns false.
+   *
+   * @returns the number of records visited
+   * @throws lmdb::error on failure
+   */
+  template<class F>
+  std::size_t scan(MDB_txn* const txn,
+                   const std::string_view from,
+                   F&& fn) const {
+    auto cursor = lmdb::cursor::open(txn, _dbi);
+    std::string_view ck{from}, cv;
+    bool cvalid = cursor.get(ck, cv, from.empty() ? MDB_FIRST : MDB_SET_RANGE);
+    auto it = _entries.lower_bound(from);
+
+    std::size_t count = 0;
+    while (cvalid || it != _entries.end()) {
+      const int c = !cvalid ? 1 : (it == _entries.end() ? -1 : ck.compare(it->first));
+      std::string_view key, val;
+      bool live;
+      if (c < 0) {
+        key = ck; val = cv; live = true;
+      } else {
+        key = it->first; val = it->second.val; live = !it->second.deleted;
+      }
+      if (live) {
+        ++count;
+        if (!fn(key, val)) break;
+      }
+      if (c <= 0) cvalid = cursor.get(ck, cv, MDB_NEXT);
+      if (c >= 0) ++it;
+    }
+    return count;
+  }
+
+  /**
+   * Writes the buffer to the database in one transaction, in key order, then
+   * empties it. Keys past the current end of the database are written with
+   * `MDB_APPEND`.
+   *
+   * @returns the number of records written or deleted
+   * @throws lmdb::error on failure (the buffer is kept)
+   */
+  std::size_t flush() {
+    if (_entries.empty()) return 0;
+
+    auto txn = lmdb::txn::begin(_env);
+    {
+      auto cursor = lmdb::cursor::open(txn, _dbi);
+      std::string_view last, v;
+      bool has_last = cursor.get(last, v, MDB_LAST);
+      const std::string initial_last{last}; /* the page may change under us */
+      last = initial_last;
+
+      for (const auto& [key, e] : _entries) {
+        const std::string_view k{key};
+        if (e.deleted) {
+          std::string_view found{k};
+          if (cursor.get(found, v, MDB_SET)) cursor.del();
+          continue;
+        }
+        const MDB_val kv{k.size(), const_cast<char*>(k.data())};
+        const MDB_val lv{last.size(), const_cast<char*>(last.data())};
+        const bool append = !has_last || lmdb::dbi_cmp(txn, _dbi, &kv, &lv) > 0;
+        cursor.put(k, e.val, append ? MDB_APPEND : 0);
+        if (append) {
+          last = k;
+          has_last = true;
+        }
+      }
+    } /* the cursor must be closed before the commit */
+    txn.commit();
+
+    const std::size_t count = _entries.size();
+    _entries.clear();
+    _arena.release();
+    _bytes = 0;
+    return count;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_MEMTABLE_H */
@@ -0,0 +1,208 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_MERGE_ITERATOR_H
+#define LMDBXX_MERGE_ITERATOR_H
+
+/**
+ * <lmdbxx/merge_iterator.h> - Ordered k-way merge over cursors for lmdb++.
+ *
+ * `lmdb::merge_iterator` iterates N sorted cursors as one stream in global
+ * key order. The cursors can be on different databases, transactions or
+ * environments. It is built on a loser tree, so each step costs
+ * `log2(N)` comparisons. Equal keys from different sources can be kept, or
+ * resolved in favour of the first or the last source, e.g. to overlay a
+ * delta database on a base database without copying either.
+ */
+
+#include "lmdb++.h"
+
+#include <string>      /* for std::string */
+#include <string_view> /* for std::string_view */
+#include <utility>     /* for std::swap() */
+#include <vector>      /* for std::vector */
+
+namespace lmdb {
+  class merge_iterator;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Merge Iterators */
+
+/**
+ * Merges several cursors into one ordered stream of key/value pairs.
+ *
+ * The cursors are not owned, and must outlive the iterator and stay
+ * positioned where the iterator leaves them. Views returned by `next()` are
+ * valid until the next call to `next()` or `seek()` (and for as long as the
+ * underlying transactions allow).
+ *
+ * @note Instances of this class are movable, but not copyable.
+ */
+class lmdb::merge_iterator {
+public:
+  /**
+   * What to do with records whose keys compare equal across sources (or
+   * within an `MDB_DUPSORT` source).
+   */
+  enum class policy {
+    /** Yield every record; for equal keys, lower source indices come first. */
+    keep_all,
+    /** Yield only the record from the lowest source index. */
+    first_wins,
+    /** Yield only the record from the highest source index (overlay). */
+    last_wins,
+  };
+
+protected:
+  struct source {
+    MDB_cursor* cursor;
+    std::string_view key;
+    std::string_view val;
+    bool valid;
+  };
+
+  std::vector<source> _sources;
+  /* _tree[0] is the winner; _tree[1..k) hold the loser of each match. */
+  std::vector<std::size_t> _tree;
+  MDB_cmp_func* _cmp;
+  policy _policy;
+  std::size_t _current{0};
+  bool _positioned{false};
+  bool _started{false};
+  std::string _last_key;
+
+  int compare(const std::string_view a,
+              const std::string_view b) const noexcept {
+    if (!_cmp) return a.compare(b);
+    const MDB_val av{a.size(), const_cast<char*>(a.data())};
+    const MDB_val bv{b.size(), const_cast<char*>(b.data())};
+    return _cmp(&av, &bv);
+  }
+
+  /* Whether source `a` should be yielded before source `b`. */
+  bool beats(const std::size_t a,
+             const std::size_t b) const noexcept {
+    if (!_sources[a].valid) return false;
+    if (!_sources[b].valid) return true;
+    const int c = compare(_sources[a].key, _sources[b].key);
+    if (c != 0) return c < 0;
+    return _policy == policy::last_wins ? a > b : a < b;
+  }
+
+  void build() {
+    const std::size_t k = _sources.size();
+    std::vector<std::size_t> winners(2 * k);
+    for (std::size_t i = 0; i < k; ++i) winners[k + i] = i;
+    for (std::size_t n = k - 1; n >= 1; --n) {
+      const auto l = winners[2 * n], r = winners[2 * n + 1];
+      if (beats(l, r)) { winners[n] = l; _tree[n] = r; }
+      else { winners[n] = r; _tree[n] = l; }
+    }
+    _tree[0] = (k > 1) ? winners[1] : 0;
+  }
+
+  void replay(const std::size_t s) noexcept {
+    std::size_t winner = s;
+    for (std::size_t n = (s + _sources.size()) / 2; n >= 1; n /= 2) {
+      if (beats(_tree[n], winner)) std::swap(_tree[n], winner);
+    }
+    _tree[0] = winner;
+  }
+
+  void advance(const std::size_t s) {
+    auto& src = _sources[s];
+    MDB_val k{}, v{};
+    src.valid = lmdb::cursor_get(src.cursor, &k, &v, MDB_NEXT);
+    if (src.valid) {
+      src.key = {static_cast<const char*>(k.mv_data), k.mv_size};
+      src.val = {static_cast<const char*>(v.mv_data), v.mv_size};
+    }
+    replay(s);
+  }
+
+public:
+  /**
+   * Constructor.
+   *
+   * @param cursors the sources, in priority order for `first_wins`/`last_wins`
+   * @param pol how to resolve equal keys
+   * @param cmp the key comparison function, or nullptr for LMDB's default
+   *            (lexicographic) order; it must match the order of every source
+   */
+  explicit merge_iterator(const std::vector<MDB_cursor*>& cursors,
+                          const policy pol = policy::keep_all,
+                          MDB_cmp_func* const cmp = nullptr)
+    : _tree(cursors.size() ? cursors.size() : 1),
+      _cmp{cmp},
+      _policy{pol} {
+    _sources.reserve(cursors.size());
+    for (auto* const c : cursors) _sources.push_back({c, {}, {}, false});
+  }
+
+  /**
+   * Positions every source at the first key not less than `from` (or at
+   * its first key, if `from` is empty).
+   *
+   * @throws lmdb::error on failure
+   */
+  void seek(const std::string_view from = {}) {
+    for (auto& src : _sources) {
+      MDB_val k{from.size(), const_cast<char*>(from.data())}, v{};
+      src.valid = lmdb::cursor_get(src.cursor, &k, &v, from.empty() ? MDB_FIRST : MDB_SET_RANGE);
+      if (src.valid) {
+        src.key = {static_cast<const char*>(k.mv_data), k.mv_size};
+        src.val = {static_cast<const char*>(v.mv_data), v.mv_size};
+      }
+    }
+    if (!_sources.empty()) build();
+    _positioned = true;
+    _started = false;
+  }
+
+  /**
+   * Retrieves the next record in merged order. Calls `seek()` first if it
+   * has not been called yet.
+   *
+   * @retval true  if a record was retrieved
+   * @retval false once all sources are exhausted
+   * @throws lmdb::error on failure
+   */
+  bool next(std::string_view& key,
+            std::string_view& val) {
+    if (_sources.empty()) return false;
+    if (!_positioned) seek();
+
+    if (_started) {
+      advance(_current);
+      if (_policy != policy::keep_all) {
+        /* Skip the records shadowed by the one just yielded. */
+        while (_sources[_tree[0]].valid && compare(_sources[_tree[0]].key, _last_key) == 0) {
+          advance(_tree[0]);
+        }
+      }
+    }
+
+    _current = _tree[0];
+    const auto& src = _sources[_current];
+    if (!src.valid) {
+      _started = false;
+      return false;
+    }
+    if (_policy != policy::keep_all) _last_key.assign(src.key.data(), src.key.size());
+    _started = true;
+    key = src.key;
+    val = src.val;
+    return true;
+  }
+
+  /**
+   * Returns the index of the source that produced the last record.
+   */
+  std::size_t source() const noexcept {
+    return _current;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_MERGE_ITERATOR_H */
@@ -0,0 +1,227 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_OPTIMISTIC_H
+#define LMDBXX_OPTIMISTIC_H
+
+/**
+ * <lmdbxx/optimistic.h> - Optimistic read-modify-write transactions for lmdb++.
+ *
+ * A write transaction holds the environment's single writer lock for as
+ * long as it is open, so expensive computation inside one serializes every
+ * writer. `lmdb::optimistic_txn` does the computation against a read-only
+ * snapshot instead. It records what was read (a hash of each observed value)
+ * and buffers what is to be written. `commit()` then opens a short write
+ * transaction that re-checks the reads and applies the writes, or gives up
+ * if another writer got in between. `lmdb::optimistic()` retries until the
+ * commit succeeds.
+ */
+
+#include "lmdb++.h"
+#include "detail.h"
+
+#include <cerrno>      /* for EBUSY */
+#include <cstddef>     /* for std::size_t */
+#include <cstdint>     /* for std::uint64_t */
+#include <map>         /* for std::map */
+#include <optional>    /* for std::optional */
+#include <string>      /* for std::string */
+#include <string_view> /* for std::string_view */
+#include <type_traits> /* for std::is_same_v */
+#include <utility>     /* for std::pair */
+
+namespace lmdb {
+  class optimistic_txn;
+
+  template<class F>
+  static std::size_t optimistic(MDB_env* env, F&& fn, std::size_t max_attempts = 16);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Optimistic Transactions */
+
+/**
+ * A transaction that reads from a snapshot and writes at validation time.
+ *
+ * Reads see the transaction's own buffered writes first, then the snapshot.
+ * Every key read from the snapshot is recorded, including keys found to be
+ * absent. At commit time each of them must still hash to what was observed,
+ * or the commit fails. Only point reads are tracked: a key inserted into a
+ * range the caller iterated through `snapshot()` is not detected.
+ *
+ * @warning Not for `MDB_DUPSORT` databases. Views returned by `get()` are
+ *          valid until the next `put()`, `del()`, `commit()` or `retry()`.
+ * @note Instances of this class are neither copyable nor movable.
+ */
+class lmdb::optimistic_txn {
+protected:
+  using key_type = std::pair<MDB_dbi, std::string>;
+
+  struct observation {
+    bool found;
+    std::size_t size;
+    std::uint64_t hash;
+  };
+
+  MDB_env* _env;
+  lmdb::txn _snapshot;
+  std::map<key_type, observation> _reads;
+  std::map<key_type, std::optional<std::string>> _writes;
+
+  static observation observe(const bool found,
+                             const std::string_view val) noexcept {
+    return found ? observation{true, val.size(), detail::hash64(val)} : observation{false, 0, 0};
+  }
+
+public:
+  /**
+   * Constructor. Begins the read-only snapshot.
+   *
+   * @param env the environment
+   * @throws lmdb::error on failure
+   */
+  explicit optimistic_txn(MDB_env* const env)
+    : _env{env},
+      _snapshot{lmdb::txn::begin(env, nullptr, MDB_RDONLY)} {}
+
+  optimistic_txn(const optimistic_txn&) = delete;
+  optimistic_txn& operator=(const optimistic_txn&) = delete;
+
+  /**
+   * Returns the snapshot's `MDB_txn*` handle, e.g. for opening cursors.
+   * Records read through it directly are not validated.
+   */
+  MDB_txn* snapshot() const noexcept {
+    return _snapshot.handle();
+  }
+
+  /**
+   * Returns the number of keys in the read set.
+   */
+  std::size_t reads() const noexcept {
+    return _reads.size();
+  }
+
+  /**
+   * Returns the number of keys in the write set.
+   */
+  std::size_t writes() const noexcept {
+    return _writes.size();
+  }
+
+  /**
+   * Retrieves a value and adds the key to the read set.
+   *
+   * @retval true  if the key was found
+   * @retval false if the key was not found (or is deleted in the write set)
+   * @throws lmdb::error on failure
+   */
+  bool get(const MDB_dbi dbi,
+           const std::string_view key,
+           std::string_view& val) {
+    key_type k{dbi, std::string{key}};
+    const auto w = _writes.find(k);
+    if (w != _writes.end()) {
+      if (!w->second) return false;
+      val = *w->second;
+      return true;
+    }
+    std::string_view v;
+    const bool found = lmdb::dbi{dbi}.get(_snapshot, key, v);
+    _reads.emplace(std::move(k), observe(found, v));
+    if (found) val = v;
+    return found;
+  }
+
+  /**
+   * Buffers a key/value pair for `commit()`.
+   */
+  void put(const MDB_dbi dbi,
+           const std::string_view key,
+           const std::string_view val) {
+    _writes[key_type{dbi, std::string{key}}].emplace(val);
+  }
+
+  /**
+   * Buffers the removal of a key for `commit()`.
+   */
+  void del(const MDB_dbi dbi,
+           const std::string_view key) {
+    _writes[key_type{dbi, std::string{key}}].reset();
+  }
+
+  /**
+   * Validates the read set and applies the write set in one short write
+   * transaction. The snapshot is released first.
+   *
+   * @retval true  if the writes were committed
+   * @retval false if a key in the read set has changed (nothing is written)
+   * @throws lmdb::error on failure
+   */
+  bool commit(const unsigned int flags = 0) {
+    _snapshot.reset();
+    if (_writes.empty()) return true; /* the snapshot was consistent */
+
+    auto txn = lmdb::txn::begin(_env, nullptr, flags);
+    for (const auto& [k, seen] : _reads) {
+      std::string_view v;
+      const bool found = lmdb::dbi{k.first}.get(txn, k.second, v);
+      const auto now = observe(found, v);
+      if (now.found != seen.found || now.size != seen.size || now.hash != seen.hash) {
+        return false; /* the write transaction is aborted */
+      }
+    }
+    for (const auto& [k, val] : _writes) {
+      lmdb::dbi dbi{k.first};
+      if (val) dbi.put(txn, k.second, *val);
+      else dbi.del(txn, k.second);
+    }
+    txn.commit();
+    return true;
+  }
+
+  /**
+   * Clears the read and write sets and starts over on a fresh snapshot.
+   *
+   * @throws lmdb::error on failure
+   */
+  void retry() {
+    _reads.clear();
+    _writes.clear();
+    _snapshot.reset();
+    _snapshot.renew();
+  }
+};
+
+/**
+ * Runs `fn(lmdb::optimistic_txn&)` and commits its writes, starting over on
+ * a fresh snapshot whenever validation fails. If `fn` returns a `bool`,
+ * returning false gives up without writing anything.
+ *
+ * @param env the environment
+ * @param fn the transaction body; it may run several times
+ * @param max_attempts the number of attempts before giving up
+ * @returns the number of attempts taken, or zero if `fn` gave up
+ * @throws lmdb::error on failure, or with `EBUSY` after `max_attempts`
+ *         conflicts
+ */
+template<class F>
+static std::size_t
+lmdb::optimistic(MDB_env* const env,
+                 F&& fn,
+                 const std::size_t max_attempts) {
+  optimistic_txn txn{env};
+  for (std::size_t attempt = 1; attempt <= max_attempts; ++attempt) {
+    if (attempt > 1) txn.retry();
+    if constexpr (std::is_same_v<decltype(fn(txn)), bool>) {
+      if (!fn(txn)) return 0;
+    } else {
+      fn(txn);
+    }
+    if (txn.commit()) return attempt;
+  }
+  error::raise("lmdb::optimistic", EBUSY);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_OPTIMISTIC_H */
@@ -0,0 +1,138 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_PERIODIC_H
+#define LMDBXX_PERIODIC_H
+
+/**
+ * <lmdbxx/periodic.h> - Background thread that runs a task at an interval.
+ *
+ * Used by the maintenance components (reader monitoring, sync flushing,
+ * expiry reaping, ...) so that they share one start/stop/wake discipline.
+ */
+
+#include <chrono>             /* for std::chrono::* */
+#include <condition_variable> /* for std::condition_variable */
+#include <exception>          /* for std::exception_ptr */
+#include <functional>         /* for std::function */
+#include <mutex>              /* for std::mutex, std::unique_lock */
+#include <thread>             /* for std::thread */
+#include <utility>            /* for std::move() */
+
+namespace lmdb {
+  class periodic_task;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Periodic Tasks */
+
+/**
+ * Runs a callable on a dedicated thread every `interval`, until stopped.
+ *
+ * The task can also be woken early with `wake()`. Exceptions thrown by the
+ * callable do not stop the thread; the most recent one is kept and can be
+ * retrieved with `last_error()`.
+ *
+ * @note Instances of this class are neither copyable nor movable.
+ */
+class lmdb::periodic_task {
+protected:
+  std::function<void()> _fn;
+  std::chrono::steady_clock::duration _interval{};
+  std::thread _thread;
+  mutable std::mutex _mutex;
+  std::condition_variable _cv;
+  bool _stop{false};
+  bool _wake{false};
+  std::exception_ptr _error;
+
+  void run() {
+    std::unique_lock<std::mutex> lock{_mutex};
+    while (!_stop) {
+      _cv.wait_for(lock, _interval, [this] { return _stop || _wake; });
+      if (_stop) break;
+      _wake = false;
+      lock.unlock();
+      try {
+        _fn();
+      } catch (...) {
+        lock.lock();
+        _error = std::current_exception();
+        continue;
+      }
+      lock.lock();
+    }
+  }
+
+public:
+  periodic_task() = default;
+  periodic_task(const periodic_task&) = delete;
+  periodic_task& operator=(const periodic_task&) = delete;
+
+  /**
+   * Destructor. Stops the thread if it is running.
+   */
+  ~periodic_task() noexcept {
+    stop();
+  }
+
+  /**
+   * Starts calling `fn` every `interval` on a new thread.
+   *
+   * @note Calling this on a running task restarts it with the new settings.
+   */
+  template<class Rep, class Period>
+  void start(const std::chrono::duration<Rep, Period> interval,
+             std::function<void()> fn) {
+    stop();
+    std::lock_guard<std::mutex> lock{_mutex};
+    _fn = std::move(fn);
+    _interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval);
+    _stop = false;
+    _wake = false;
+    _thread = std::thread{[this] { run(); }};
+  }
+
+  /**
+   * Stops the thread and waits for it to exit.
+   *
+   * @note this method is idempotent
+   */
+  void stop() noexcept {
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _stop = true;
+    }
+    _cv.notify_all();
+    if (_thread.joinable()) _thread.join();
+  }
+
+  /**
+   * Runs the task as soon as possible instead of waiting for the interval.
+   */
+  void wake() noexcept {
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _wake = true;
+    }
+    _cv.notify_all();
+  }
+
+  /**
+   * Returns whether the thread is running.
+   */
+  bool running() const noexcept {
+    return _thread.joinable();
+  }
+
+  /**
+   * Returns the most recent exception thrown by the task, if any.
+   */
+  std::exception_ptr last_error() const {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _error;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_PERIODIC_H */
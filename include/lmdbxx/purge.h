@@ -0,0 +1,235 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_PURGE_H
+#define LMDBXX_PURGE_H
+
+/**
+ * <lmdbxx/purge.h> - Bulk deletion in bounded transactions for lmdb++.
+ *
+ * Deleting millions of records in one write transaction holds the writer
+ * lock for the whole run, and its dirty page list can overflow
+ * (`MDB_TXN_FULL`). The functions in this header delete in chunks instead.
+ * Each chunk is a separate short write transaction, and the writer lock is
+ * released in between. Progress is reported after every chunk, and the work
+ * can be stopped and later resumed where it left off.
+ *
+ * `lmdb::drop_incremental()` uses the same mechanism to retire a whole named
+ * database. It is first marked as being dropped, then emptied chunk by
+ * chunk, and finally deleted in a small transaction.
+ */
+
+#include "lmdb++.h"
+
+#include <chrono>      /* for std::chrono::microseconds */
+#include <cstddef>     /* for std::size_t */
+#include <functional>  /* for std::function */
+#include <string>      /* for std::string */
+#include <string_view> /* for std::string_view */
+#include <thread>      /* for std::this_thread::sleep_for() */
+#include <vector>      /* for std::vector */
+
+namespace lmdb {
+  struct purge_progress;
+  struct purge_options;
+
+  static inline purge_progress del_range(MDB_env* env, MDB_dbi dbi, std::string_view lo,
+                                         std::string_view hi, const purge_options& opts);
+  static inline purge_progress drop_incremental(MDB_env* env, const std::string& name,
+                                                const purge_options& opts);
+  static inline std::vector<std::string> pending_drops(MDB_txn* txn);
+  static inline bool is_dropping(MDB_txn* txn, std::string_view name);
+  static inline std::size_t resume_drops(MDB_env* env, const purge_options& opts);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Purge Options */
+
+/**
+ * Progress of a chunked deletion, reported after every chunk.
+ */
+struct lmdb::purge_progress {
+  std::size_t deleted{0};  /**< records deleted so far */
+  std::size_t chunks{0};   /**< transactions committed so far */
+  std::string next_key;    /**< where the next chunk starts (empty when done) */
+  bool done{false};        /**< whether nothing is left to delete */
+};
+
+/**
+ * Limits and callbacks for a chunked deletion.
+ */
+struct lmdb::purge_options {
+  /** Records deleted per transaction at most. */
+  std::size_t max_records{10000};
+  /** Key and value bytes deleted per transaction at most (zero: no limit). */
+  std::size_t max_bytes{0};
+  /** Pause between chunks, so that other writers get the lock. */
+  std::chrono::microseconds pause{0};
+  /** Called after every chunk; returning false stops early. */
+  std::function<bool(const purge_progress&)> on_progress;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Range Deletion */
+
+/**
+ * Deletes every record with a key in `[lo, hi)` (an empty `hi` means no
+ * upper bound), `opts.max_records` records per write transaction.
+ *
+ * Deleting is idempotent, so an interrupted or stopped run can simply be
+ * resumed by calling this again. Passing the last progress report's
+ * `next_key` as `lo` just skips the lookup of the already empty prefix.
+ *
+ * @returns the final progress; `done` is false if `on_progress` stopped it
+ * @throws lmdb::error on failure (the chunks already committed stay deleted)
+ */
+static inline lmdb::purge_progress
+lmdb::del_range(MDB_env* const env,
+                const MDB_dbi dbi,
+                const std::string_view lo,
+                const std::string_view hi,
+                const purge_options& opts = {}) {
+  purge_progress progress;
+  progress.next_key.assign(lo.data(), lo.size());
+  const std::size_t max_records = opts.max_records ? opts.max_records : 1;
+
+  while (!progress.done) {
+    std::size_t records = 0, bytes = 0;
+    auto txn = lmdb::txn::begin(env);
+    {
+      auto cursor = lmdb::cursor::open(txn, dbi);
+      MDB_val k{progress.next_key.size(), progress.next_key.data()}, v{};
+      bool found = lmdb::cursor_get(cursor, &k, &v, progress.next_key.empty() ? MDB_FIRST : MDB_SET_RANGE);
+      const MDB_val hv{hi.size(), const_cast<char*>(hi.data())};
+      for (;;) {
+        if (!found || (!hi.empty() && lmdb::dbi_cmp(txn, dbi, &k, &hv) >= 0)) {
+          progress.done = true;
+          break;
+        }
+        if (records == max_records || (opts.max_bytes && bytes >= opts.max_bytes)) {
+          progress.next_key.assign(static_cast<const char*>(k.mv_data), k.mv_size);
+          break;
+        }
+        bytes += k.mv_size + v.mv_size;
+        ++records;
+        cursor.del();
+        found = lmdb::cursor_get(cursor, &k, &v, MDB_NEXT);
+      }
+    } /* the cursor must be closed before the commit */
+    txn.commit();
+
+    progress.deleted += records;
+    ++progress.chunks;
+    if (progress.done) progress.next_key.clear();
+    if (opts.on_progress && !opts.on_progress(progress)) break;
+    if (!progress.done && opts.pause.count()) std::this_thread::sleep_for(opts.pause);
+  }
+  return progress;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Incremental Drops */
+
+namespace lmdb::detail {
+  /** The database recording which databases are being dropped. */
+  static constexpr const char* drop_registry = "__lmdbxx_drops";
+}
+
+/**
+ * Drops the named database `name` without a long write stall. The database
+ * is first recorded as being dropped, then emptied with `del_range()`
+ * (with `opts`), and finally deleted with `mdb_drop()` once it is empty.
+ *
+ * Applications should stop using the database once `is_dropping()` returns
+ * true for it. If the run is stopped by `on_progress` or interrupted, the
+ * record stays behind and `resume_drops()` finishes the job.
+ *
+ * @returns the final progress; `done` is true once the database is gone
+ * @throws lmdb::error on failure
+ */
+static inline lmdb::purge_progress
+lmdb::drop_incremental(MDB_env* const env,
+                       const std::string& name,
+                       const purge_options& opts = {}) {
+  MDB_dbi dbi;
+  {
+    auto txn = lmdb::txn::begin(env);
+    const int rc = ::mdb_dbi_open(txn, name.c_str(), 0, &dbi);
+    if (rc == MDB_NOTFOUND) {
+      purge_progress progress;
+      progress.done = true;
+      return progress;
+    }
+    if (rc != MDB_SUCCESS) error::raise("mdb_dbi_open", rc);
+    lmdb::dbi::open(txn, detail::drop_registry, MDB_CREATE).put(txn, name, "");
+    txn.commit();
+  }
+
+  auto progress = lmdb::del_range(env, dbi, {}, {}, opts);
+  if (progress.done) {
+    auto txn = lmdb::txn::begin(env);
+    lmdb::dbi_drop(txn, dbi, true);
+    lmdb::dbi::open(txn, detail::drop_registry).del(txn, name);
+    txn.commit();
+  }
+  return progress;
+}
+
+/**
+ * Returns the names of the databases whose incremental drop is unfinished.
+ *
+ * @throws lmdb::error on failure
+ */
+static inline std::vector<std::string>
+lmdb::pending_drops(MDB_txn* const txn) {
+  std::vector<std::string> result;
+  MDB_dbi registry;
+  const int rc = ::mdb_dbi_open(txn, detail::drop_registry, 0, &registry);
+  if (rc == MDB_NOTFOUND) return result;
+  if (rc != MDB_SUCCESS) error::raise("mdb_dbi_open", rc);
+  auto cursor = lmdb::cursor::open(txn, registry);
+  std::string_view k, v;
+  while (cursor.get(k, v, MDB_NEXT)) result.emplace_back(k);
+  return result;
+}
+
+/**
+ * Returns whether the named database is being dropped incrementally.
+ *
+ * @throws lmdb::error on failure
+ */
+static inline bool
+lmdb::is_dropping(MDB_txn* const txn,
+                  const std::string_view name) {
+  MDB_dbi registry;
+  const int rc = ::mdb_dbi_open(txn, detail::drop_registry, 0, &registry);
+  if (rc == MDB_NOTFOUND) return false;
+  if (rc != MDB_SUCCESS) error::raise("mdb_dbi_open", rc);
+  std::string_view v;
+  return lmdb::dbi{registry}.get(txn, name, v);
+}
+
+/**
+ * Continues every unfinished incremental drop, e.g. after a restart.
+ *
+ * @returns the number of databases fully dropped
+ * @throws lmdb::error on failure
+ */
+static inline std::size_t
+lmdb::resume_drops(MDB_env* const env,
+                   const purge_options& opts = {}) {
+  std::vector<std::string> names;
+  {
+    auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+    names = pending_drops(txn);
+  }
+  std::size_t dropped = 0;
+  for (const auto& name : names) {
+    if (!drop_incremental(env, name, opts).done) break;
+    ++dropped;
+  }
+  return dropped;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_PURGE_H */
@@ -0,0 +1,261 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_QUEUE_H
+#define LMDBXX_QUEUE_H
+
+/**
+ * <lmdbxx/queue.h> - Persistent FIFO queue for lmdb++.
+ *
+ * `lmdb::queue` is a durable append-only log with named consumers. Messages
+ * are keyed by a 64-bit big-endian sequence number, so every enqueue is an
+ * `MDB_APPEND` to the rightmost leaf. Each consumer's offset is stored in a
+ * companion database and advanced in the same transaction that reads the
+ * messages. Trimming removes messages only from the head of the log, so the
+ * tree is never fragmented by random deletes.
+ */
+
+#include "lmdb++.h"
+#include "detail.h"
+
+#include <algorithm>   /* for std::min(), std::max() */
+#include <cstddef>     /* for std::size_t */
+#include <cstdint>     /* for std::uint64_t */
+#include <iterator>    /* for std::begin(), std::end() */
+#include <limits>      /* for std::numeric_limits */
+#include <string>      /* for std::string */
+#include <string_view> /* for std::string_view */
+
+namespace lmdb {
+  class queue;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Queues */
+
+/**
+ * A persistent FIFO log with per-consumer offsets.
+ *
+ * Messages live in the database `name`, keyed by their sequence number.
+ * Sequence numbers start at 1 and increase by one per message. Consumer
+ * offsets live in `name` + `"__offsets"`, and each one holds the sequence
+ * number of the next message that consumer will read. `consume()` reads
+ * and acknowledges in one write transaction, so a batch whose processing
+ * fails is delivered again (at-least-once delivery).
+ *
+ * @note Instances of this class are copyable and movable.
+ */
+class lmdb::queue {
+public:
+  static constexpr std::size_t default_trim_batch = 10000;
+
+protected:
+  MDB_env* _env;
+  MDB_dbi _log;
+  MDB_dbi _offsets;
+  std::size_t _max_records{std::numeric_limits<std::size_t>::max()};
+
+  static std::string seq_key(const std::uint64_t seq) {
+    std::string result;
+    detail::put_be64(result, seq);
+    return result;
+  }
+
+  /* Returns the sequence number of the last message (0 if none). */
+  static std::uint64_t last_seq(MDB_cursor* const cursor) {
+    MDB_val k{}, v{};
+    if (!lmdb::cursor_get(cursor, &k, &v, MDB_LAST) || k.mv_size != 8) return 0;
+    return detail::get_be64({static_cast<const char*>(k.mv_data), k.mv_size});
+  }
+
+public:
+  /**
+   * Constructor. Opens (creating if needed) the log and offset databases.
+   *
+   * @param env the environment (`set_max_dbs()` must allow two more databases)
+   * @param name the name of the log database
+   * @throws lmdb::error on failure
+   */
+  queue(MDB_env* const env,
+        const std::string& name)
+    : _env{env} {
+    auto txn = lmdb::txn::begin(env);
+    _log = lmdb::dbi::open(txn, name, MDB_CREATE);
+    _offsets = lmdb::dbi::open(txn, name + "__offsets", MDB_CREATE);
+    txn.commit();
+  }
+
+  /**
+   * Returns the log database's handle.
+   */
+  MDB_dbi log() const noexcept {
+    return _log;
+  }
+
+  /**
+   * Bounds the log to its newest `records` messages. `trim()` removes older
+   * messages even if some consumer has not read them yet.
+   */
+  queue& set_max_records(const std::size_t records) noexcept {
+    _max_records = records;
+    return *this;
+  }
+
+  /**
+   * Appends one message.
+   *
+   * @returns its sequence number
+   * @throws lmdb::error on failure
+   */
+  std::uint64_t enqueue(MDB_txn* const txn,
+                        const std::string_view val) {
+    const std::string_view vals[] = {val};
+    return enqueue(txn, std::begin(vals), std::end(vals));
+  }
+
+  /**
+   * Appends a batch of messages (anything convertible to
+   * `std::string_view`) through one cursor with `MDB_APPEND`.
+   *
+   * @returns the sequence number of the first message
+   * @throws lmdb::error on failure
+   */
+  template<class Iterator>
+  std::uint64_t enqueue(MDB_txn* const txn,
+                        Iterator first,
+                        const Iterator last) {
+    auto cursor = lmdb::cursor::open(txn, _log);
+    const std::uint64_t start = last_seq(cursor) + 1;
+    std::uint64_t seq = start;
+    std::string key;
+    for (; first != last; ++first, ++seq) {
+      key.clear();
+      detail::put_be64(key, seq);
+      cursor.put(key, std::string_view{*first}, MDB_APPEND);
+    }
+    return start;
+  }
+
+  /**
+   * Returns the offset of `consumer`: the sequence number of the next message
+   * it will read (1 for a new consumer).
+   *
+   * @throws lmdb::error on failure
+   */
+  std::uint64_t offset(MDB_txn* const txn,
+                       const std::string_view consumer) const {
+    std::string_view v;
+    if (!lmdb::dbi{_offsets}.get(txn, consumer, v) || v.size() != 8) return 1;
+    return detail::get_be64(v);
+  }
+
+  /**
+   * Calls `fn(seq, val)` for up to `max` messages starting at the offset of
+   * `consumer`, without acknowledging them.
+   *
+   * @returns the number of messages read
+   * @throws lmdb::error on failure
+   */
+  template<class F>
+  std::size_t read(MDB_txn* const txn,
+                   const std::string_view consumer,
+                   const std::size_t max,
+                   F&& fn) const {
+    const std::string from = seq_key(offset(txn, consumer));
+    auto cursor = lmdb::cursor::open(txn, _log);
+    std::string_view k{from}, v;
+    std::size_t count = 0;
+    for (bool found = cursor.get(k, v, MDB_SET_RANGE); found && count < max; found = cursor.get(k, v, MDB_NEXT)) {
+      fn(detail::get_be64(k), v);
+      ++count;
+    }
+    return count;
+  }
+
+  /**
+   * Acknowledges every message up to and including `seq` for `consumer`.
+   * Offsets never move backwards.
+   *
+   * @throws lmdb::error on failure
+   */
+  void ack(MDB_txn* const txn,
+           const std::string_view consumer,
+           const std::uint64_t seq) {
+    if (seq + 1 <= offset(txn, consumer)) return;
+    lmdb::dbi{_offsets}.put(txn, consumer, seq_key(seq + 1));
+  }
+
+  /**
+   * Reads up to `max` messages for `consumer` and acknowledges them, all in
+   * one write transaction. If `fn` throws, nothing is acknowledged.
+   *
+   * @returns the number of messages consumed
+   * @throws lmdb::error on failure
+   */
+  template<class F>
+  std::size_t consume(const std::string_view consumer,
+                      const std::size_t max,
+                      F&& fn) {
+    auto txn = lmdb::txn::begin(_env);
+    std::uint64_t last = 0;
+    const std::size_t count = read(txn, consumer, max, [&](const std::uint64_t seq, const std::string_view val) {
+      fn(seq, val);
+      last = seq;
+    });
+    if (count) ack(txn, consumer, last);
+    txn.commit();
+    return count;
+  }
+
+  /**
+   * Removes up to `limit` messages from the head of the log: those every
+   * registered consumer has acknowledged, plus those beyond the newest
+   * `set_max_records()` messages. The newest message is always kept, since
+   * the next sequence number is derived from it.
+   *
+   * @returns the number of messages removed
+   * @throws lmdb::error on failure
+   */
+  std::size_t trim(MDB_txn* const txn,
+                   const std::size_t limit = default_trim_batch) {
+    /* Everything below the slowest consumer's offset can go. */
+    std::uint64_t bound = std::numeric_limits<std::uint64_t>::max();
+    {
+      auto cursor = lmdb::cursor::open(txn, _offsets);
+      std::string_view k, v;
+      while (cursor.get(k, v, MDB_NEXT)) {
+        if (v.size() == 8) bound = std::min(bound, detail::get_be64(v));
+      }
+    }
+
+    auto cursor = lmdb::cursor::open(txn, _log);
+    const std::uint64_t newest = last_seq(cursor);
+    if (newest == 0) return 0;
+    if (_max_records < newest) {
+      const std::uint64_t keep_from = newest - _max_records + 1;
+      bound = (bound == std::numeric_limits<std::uint64_t>::max()) ? keep_from : std::max(bound, keep_from);
+    }
+    if (bound == std::numeric_limits<std::uint64_t>::max()) return 0; /* no consumers, no limit */
+    bound = std::min(bound, newest); /* the newest message anchors the sequence */
+
+    std::size_t count = 0;
+    std::string_view k, v;
+    for (bool found = cursor.get(k, v, MDB_FIRST); found && count < limit && detail::get_be64(k) < bound; found = cursor.get(k, v, MDB_NEXT)) {
+      cursor.del();
+      ++count;
+    }
+    return count;
+  }
+
+  /**
+   * Returns the number of messages in the log.
+   *
+   * @throws lmdb::error on failure
+   */
+  std::size_t size(MDB_txn* const txn) const {
+    return lmdb::dbi{_log}.size(txn);
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_QUEUE_H */
@@ -0,0 +1,294 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_READER_MONITOR_H
+#define LMDBXX_READER_MONITOR_H
+
+/**
+ * <lmdbxx/reader_monitor.h> - Stale reader detection for lmdb++.
+ *
+ * A reader slot left behind by a crashed process, or a read transaction that
+ * is simply held for too long, pins old pages: LMDB cannot reuse them and
+ * the data file keeps growing. `lmdb::reader_monitor` periodically clears
+ * dead slots with `mdb_reader_check()`, inspects the reader table with
+ * `mdb_reader_list()`, and reports readers that are too old.
+ */
+
+#include "lmdb++.h"
+#include "periodic.h"
+
+#include <algorithm>   /* for std::max() */
+#include <atomic>      /* for std::atomic<> */
+#include <chrono>      /* for std::chrono::* */
+#include <cstdlib>     /* for std::strtol(), std::strtoull() */
+#include <functional>  /* for std::function */
+#include <map>         /* for std::map */
+#include <mutex>       /* for std::mutex, std::lock_guard */
+#include <tuple>       /* for std::tuple */
+#include <vector>      /* for std::vector */
+
+namespace lmdb {
+  struct reader_info;
+  static inline std::vector<reader_info> reader_table(MDB_env* env);
+  class reader_monitor;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Reader Table */
+
+/**
+ * One slot of the environment's reader lock table.
+ */
+struct lmdb::reader_info {
+  /** Process ID of the slot's owner. */
+  long pid;
+  /** Thread ID of the slot's owner, as printed by LMDB. */
+  std::size_t thread;
+  /** Snapshot the reader is using; only meaningful if `active`. */
+  std::size_t txnid;
+  /** Whether the slot currently holds a snapshot (is not reset/idle). */
+  bool active;
+};
+
+/**
+ * Returns the parsed contents of the environment's reader lock table.
+ *
+ * @throws lmdb::error on failure
+ */
+static inline std::vector<lmdb::reader_info>
+lmdb::reader_table(MDB_env* const env) {
+  std::vector<reader_info> result;
+  lmdb::reader_list(env, +[](const char* const msg, void* const ctx) -> int {
+    /* Lines look like "%10d %zx %zu" or "%10d %zx -"; skip anything else. */
+    char* end;
+    const long pid = std::strtol(msg, &end, 10);
+    if (end == msg) return 0;
+    const char* p = end;
+    const std::size_t thread = std::strtoull(p, &end, 16);
+    if (end == p) return 0;
+    p = end;
+    while (*p == ' ') ++p;
+    reader_info info{pid, thread, 0, false};
+    if (*p != '-') {
+      info.txnid = std::strtoull(p, &end, 10);
+      info.active = (end != p);
+    }
+    static_cast<std::vector<reader_info>*>(ctx)->push_back(info);
+    return 0;
+  }, &result);
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Reader Monitor */
+
+/**
+ * Periodically clears stale reader slots and reports long-lived readers.
+ *
+ * The age of a reader is measured from the first check that saw its
+ * snapshot, so its resolution is the check interval. The lag of a reader is
+ * the number of transactions committed since its snapshot was taken.
+ *
+ * @note Instances of this class are neither copyable nor movable.
+ */
+class lmdb::reader_monitor {
+public:
+  using clock = std::chrono::steady_clock;
+
+  /**
+   * A reader that exceeded the configured age or lag limit.
+   */
+  struct stale_reader {
+    reader_info reader;
+    clock::duration age;
+    std::size_t lag;
+  };
+
+  using callback = std::function<void(const stale_reader&)>;
+
+protected:
+  struct sighting {
+    clock::time_point first_seen;
+    bool reported;
+  };
+
+  MDB_env* _env;
+  mutable std::mutex _mutex;
+  clock::duration _max_age{};
+  std::size_t _max_lag{0};
+  callback _on_stale;
+  std::map<std::tuple<long, std::size_t, std::size_t>, sighting> _seen;
+
+  std::atomic<clock::rep> _oldest_age{0};
+  std::atomic<std::size_t> _oldest_lag{0};
+  std::atomic<std::size_t> _active{0};
+  std::atomic<std::size_t> _dead{0};
+  std::atomic<std::size_t> _checks{0};
+
+  periodic_task _task;
+
+public:
+  /**
+   * Constructor.
+   *
+   * @param env the environment to watch
+   */
+  explicit reader_monitor(MDB_env* const env) noexcept
+    : _env{env} {}
+
+  /**
+   * Destructor. Stops the background thread.
+   */
+  ~reader_monitor() noexcept {
+    stop();
+  }
+
+  /**
+   * Readers older than `age` are reported (zero disables the limit).
+   */
+  reader_monitor& set_max_age(const clock::duration age) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _max_age = age;
+    return *this;
+  }
+
+  /**
+   * Readers lagging `lag` or more transactions behind are reported
+   * (zero disables the limit).
+   */
+  reader_monitor& set_max_lag(const std::size_t lag) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _max_lag = lag;
+    return *this;
+  }
+
+  /**
+   * Sets the callback invoked, once per reader snapshot, for readers that
+   * exceed a limit. It may, for instance, signal the offending process.
+   */
+  reader_monitor& set_on_stale(callback on_stale) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _on_stale = std::move(on_stale);
+    return *this;
+  }
+
+  /**
+   * Starts checking every `interval` on a background thread.
+   */
+  template<class Rep, class Period>
+  void start(const std::chrono::duration<Rep, Period> interval) {
+    _task.start(interval, [this] { check(); });
+  }
+
+  /**
+   * Stops the background thread.
+   *
+   * @note this method is idempotent
+   */
+  void stop() noexcept {
+    _task.stop();
+  }
+
+  /**
+   * Performs one check synchronously.
+   *
+   * @throws lmdb::error on failure
+   */
+  void check() {
+    int dead = 0;
+    lmdb::reader_check(_env, &dead);
+    if (dead > 0) _dead += static_cast<std::size_t>(dead);
+
+    const auto readers = reader_table(_env);
+    MDB_envinfo info;
+    lmdb::env_info(_env, &info);
+    const auto now = clock::now();
+
+    std::vector<stale_reader> offenders;
+    callback on_stale;
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      decltype(_seen) seen;
+      clock::duration oldest_age{};
+      std::size_t oldest_lag = 0, active = 0;
+
+      for (const auto& r : readers) {
+        if (!r.active) continue;
+        ++active;
+
+        const auto key = std::make_tuple(r.pid, r.thread, r.txnid);
+        const auto it = _seen.find(key);
+        sighting s = (it != _seen.end()) ? it->second : sighting{now, false};
+
+        const auto age = now - s.first_seen;
+        const std::size_t lag = info.me_last_txnid > r.txnid ? info.me_last_txnid - r.txnid : 0;
+        oldest_age = std::max(oldest_age, age);
+        oldest_lag = std::max(oldest_lag, lag);
+
+        const bool too_old = _max_age.count() > 0 && age >= _max_age;
+        const bool too_far = _max_lag > 0 && lag >= _max_lag;
+        if (!s.reported && (too_old || too_far)) {
+          s.reported = true;
+          offenders.push_back({r, age, lag});
+        }
+        seen.emplace(key, s);
+      }
+
+      _seen.swap(seen);
+      _oldest_age = oldest_age.count();
+      _oldest_lag = oldest_lag;
+      _active = active;
+      on_stale = _on_stale;
+    }
+
+    ++_checks;
+    if (on_stale) {
+      for (const auto& o : offenders) on_stale(o);
+    }
+  }
+
+  /**
+   * Returns the age of the oldest active reader as of the last check.
+   */
+  clock::duration oldest_reader_age() const noexcept {
+    return clock::duration{_oldest_age.load()};
+  }
+
+  /**
+   * Returns the largest reader lag (in transactions) as of the last check.
+   */
+  std::size_t oldest_reader_lag() const noexcept {
+    return _oldest_lag;
+  }
+
+  /**
+   * Returns the number of active readers as of the last check.
+   */
+  std::size_t active_readers() const noexcept {
+    return _active;
+  }
+
+  /**
+   * Returns the total number of dead reader slots cleared so far.
+   */
+  std::size_t dead_readers_cleared() const noexcept {
+    return _dead;
+  }
+
+  /**
+   * Returns the number of checks performed so far.
+   */
+  std::size_t checks() const noexcept {
+    return _checks;
+  }
+
+  /**
+   * Returns the most recent exception thrown by a background check, if any.
+   */
+  std::exception_ptr last_error() const {
+    return _task.last_error();
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_READER_MONITOR_H */
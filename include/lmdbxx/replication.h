@@ -0,0 +1,683 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_REPLICATION_H
+#define LMDBXX_REPLICATION_H
+
+/**
+ * <lmdbxx/replication.h> - Log-shipping replication for lmdb++.
+ *
+ * A leader records the mutations made through an `lmdb::repl_txn` and, once
+ * that transaction has committed, emits them as a single framed batch to a
+ * sink (a file, a pipe, a socket, ...). A follower consumes the byte stream
+ * and replays the batches into its own environment, remembering the last
+ * leader transaction ID it applied so that replaying a log is idempotent.
+ *
+ * Frame layout (all integers are LEB128 varints unless noted otherwise):
+ *
+ *     frame := 0xA7 size body checksum      (checksum: 4 bytes, little-endian)
+ *     body  := txn_id ndbis {name flags}* nops op*
+ *     op    := kind(1 byte) dbi_index key [value]
+ *
+ * Keys, values and DBI names are length-prefixed. The unnamed database is
+ * encoded with an empty name.
+ */
+
+#include "lmdb++.h"
+#include "detail.h"
+
+#include <algorithm>   /* for std::min() */
+#include <cstdint>     /* for std::uint64_t */
+#include <functional>  /* for std::function */
+#include <map>         /* for std::map */
+#include <mutex>       /* for std::mutex, std::unique_lock */
+#include <string>      /* for std::string */
+#include <string_view> /* for std::string_view */
+#include <utility>     /* for std::pair */
+#include <vector>      /* for std::vector */
+
+#ifndef _WIN32
+#include <cerrno>      /* for errno, EINTR */
+#include <unistd.h>    /* for ::read(), ::write() */
+#endif
+
+namespace lmdb {
+  class repl_leader;
+  class repl_txn;
+  class repl_follower;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Replication: Leader */
+
+/**
+ * Serializes committed write transactions into a replication log.
+ *
+ * All writes that should be replicated must go through `repl_txn` objects
+ * obtained from `begin()`. The leader serializes these transactions itself,
+ * so that frames always reach the sink in commit order.
+ *
+ * @note The frame is emitted after the LMDB commit succeeded. If the sink
+ *       throws, the local commit stands but followers will miss the batch.
+ */
+class lmdb::repl_leader {
+  friend class repl_txn;
+
+public:
+  /**
+   * Receives one complete frame per committed transaction.
+   */
+  using sink = std::function<void(std::string_view frame)>;
+
+protected:
+  MDB_env* _env;
+  sink _sink;
+  sink _tap;
+  std::mutex _mutex;
+  std::map<MDB_dbi, std::pair<std::string, unsigned int>> _dbis;
+  std::uint64_t _id_offset;
+
+public:
+  /**
+   * Constructor.
+   *
+   * @param env the environment to replicate
+   * @param sink where frames are written to
+   * @param id_offset added to LMDB transaction IDs to form the logged IDs
+   *        (see `rebind()`)
+   */
+  repl_leader(MDB_env* const env,
+              sink sink,
+              const std::uint64_t id_offset = 0)
+    : _env{env},
+      _sink{std::move(sink)},
+      _id_offset{id_offset} {}
+
+  repl_leader(const repl_leader&) = delete;
+  repl_leader& operator=(const repl_leader&) = delete;
+
+  /**
+   * Returns the underlying `MDB_env*` handle.
+   */
+  MDB_env* env() const noexcept {
+    return _env;
+  }
+
+  /**
+   * Returns the offset added to LMDB transaction IDs to form the logged IDs.
+   */
+  std::uint64_t id_offset() const noexcept {
+    return _id_offset;
+  }
+
+  /**
+   * Returns the ID of the last transaction committed on the current
+   * environment, as logged (i.e. including `id_offset()`).
+   *
+   * @throws lmdb::error on failure
+   */
+  std::uint64_t last_id() const {
+    MDB_envinfo info;
+    lmdb::env_info(_env, &info);
+    return info.me_last_txnid + _id_offset;
+  }
+
+  /**
+   * Moves the leader to another environment holding the same data, such as
+   * the result of an online compaction. Writers must be paused by the
+   * caller, and `paused` must be the lock returned by `pause()`.
+   *
+   * The new environment's transaction IDs start over, so the offset is
+   * raised to keep the logged IDs above `last`, and followers keep applying
+   * frames. Persist `id_offset()` and pass it to the constructor when the
+   * leader is recreated on the new environment.
+   *
+   * @param paused the lock returned by `pause()`
+   * @param env the new environment
+   * @param last the value of `last_id()` taken while writers were paused and
+   *        the old environment was still open (the old environment is not
+   *        accessed here, so it may already be closed)
+   * @note DBI handles of the old environment become invalid; reopen them
+   *       with `repl_txn::open_dbi()`.
+   * @throws lmdb::error on failure
+   */
+  void rebind(const std::unique_lock<std::mutex>& paused,
+              MDB_env* const env,
+              const std::uint64_t last) {
+    if (!env || paused.mutex() != &_mutex || !paused.owns_lock()) {
+      error::raise("repl_leader::rebind", EINVAL);
+    }
+    MDB_envinfo info;
+    lmdb::env_info(env, &info);
+    _id_offset = last > info.me_last_txnid ? last - info.me_last_txnid : 0;
+    _env = env;
+    _dbis.clear();
+  }
+
+  /**
+   * Begins a replicated write transaction.
+   *
+   * @throws lmdb::error on failure
+   */
+  inline repl_txn begin();
+
+  /**
+   * Installs a second sink that receives every frame after the main sink,
+   * e.g. to feed an online compaction. Pass an empty function to remove it.
+   *
+   * @note Blocks until the write transaction in progress, if any, has ended.
+   */
+  void set_tap(sink tap) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _tap = std::move(tap);
+  }
+
+  /**
+   * Blocks replicated writers until the returned lock is released. Waits for
+   * the write transaction in progress, if any, to end first.
+   */
+  std::unique_lock<std::mutex> pause() {
+    return std::unique_lock<std::mutex>{_mutex};
+  }
+
+#ifndef _WIN32
+  /**
+   * Returns a sink that writes frames to a file descriptor, such as a log
+   * file opened with `O_APPEND`, a pipe, or a connected socket.
+   */
+  static sink fd_sink(const int fd) {
+    return [fd](std::string_view frame) {
+      while (!frame.empty()) {
+        const auto n = ::write(fd, frame.data(), frame.size());
+        if (n < 0) {
+          if (errno == EINTR) continue;
+          error::raise("repl_leader: write", errno);
+        }
+        frame.remove_prefix(static_cast<std::size_t>(n));
+      }
+    };
+  }
+#endif
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Replication: Transactions */
+
+/**
+ * A write transaction whose mutations are recorded for replication.
+ *
+ * Only mutations made through this object's methods are replicated. DBIs
+ * must be opened through `open_dbi()` so the leader knows their names.
+ *
+ * @note Instances of this class are movable, but not copyable.
+ */
+class lmdb::repl_txn {
+  friend class repl_leader;
+
+public:
+  static constexpr unsigned char op_put      = 1;
+  static constexpr unsigned char op_del      = 2;
+  static constexpr unsigned char op_del_dup  = 3;
+  static constexpr unsigned char op_drop     = 4;
+  static constexpr unsigned char op_drop_del = 5;
+
+protected:
+  repl_leader* _leader;
+  std::unique_lock<std::mutex> _lock;
+  lmdb::txn _txn;
+  std::uint64_t _id;
+  std::vector<MDB_dbi> _dbis;
+  std::string _ops;
+  std::size_t _count{0};
+
+  explicit repl_txn(repl_leader& leader)
+    : _leader{&leader},
+      _lock{leader._mutex},
+      _txn{lmdb::txn::begin(leader._env)} {
+#ifdef LMDBXX_TXN_ID
+    _id = lmdb::txn_id(_txn) + leader._id_offset;
+#else
+    /* While we hold the write lock nobody else can commit, so our
+       transaction will be assigned the next ID. */
+    MDB_envinfo info;
+    lmdb::env_info(leader._env, &info);
+    _id = info.me_last_txnid + 1 + leader._id_offset;
+#endif
+  }
+
+  std::size_t index_of(const MDB_dbi dbi) {
+    for (std::size_t i = 0; i < _dbis.size(); ++i) {
+      if (_dbis[i] == dbi) return i;
+    }
+    if (_leader->_dbis.find(dbi) == _leader->_dbis.end()) {
+      error::raise("repl_txn: dbi was not opened through open_dbi()", EINVAL);
+    }
+    _dbis.push_back(dbi);
+    return _dbis.size() - 1;
+  }
+
+  void record(const unsigned char kind,
+              const MDB_dbi dbi,
+              const std::string_view key,
+              const std::string_view* const val = nullptr) {
+    _ops.push_back(static_cast<char>(kind));
+    detail::put_varint(_ops, index_of(dbi));
+    detail::put_bytes(_ops, key);
+    if (val) detail::put_bytes(_ops, *val);
+    ++_count;
+  }
+
+  std::string frame() const {
+    std::string body;
+    detail::put_varint(body, _id);
+    detail::put_varint(body, _dbis.size());
+    for (const auto dbi : _dbis) {
+      const auto& entry = _leader->_dbis.at(dbi);
+      detail::put_bytes(body, entry.first);
+      detail::put_varint(body, entry.second);
+    }
+    detail::put_varint(body, _count);
+    body += _ops;
+
+    std::string result;
+    result.push_back(static_cast<char>(0xA7));
+    detail::put_varint(result, body.size());
+    result += body;
+    const std::uint32_t sum = detail::checksum(body);
+    for (int i = 0; i < 4; ++i) {
+      result.push_back(static_cast<char>((sum >> (8 * i)) & 0xFF));
+    }
+    return result;
+  }
+
+public:
+  repl_txn(repl_txn&& other) noexcept = default;
+
+  /**
+   * Returns the underlying `MDB_txn*` handle.
+   *
+   * @note Writes made directly through this handle are *not* replicated.
+   */
+  operator MDB_txn*() const noexcept {
+    return _txn.handle();
+  }
+
+  /**
+   * Returns the underlying `MDB_txn*` handle.
+   */
+  MDB_txn* handle() const noexcept {
+    return _txn.handle();
+  }
+
+  /**
+   * Returns the leader transaction ID this batch will be logged under.
+   */
+  std::uint64_t id() const noexcept {
+    return _id;
+  }
+
+  /**
+   * Opens a database handle and registers its name with the leader.
+   *
+   * @param name the database name, or nullptr
+   * @param flags dbi flags, ie MDB_CREATE
+   * @throws lmdb::error on failure
+   */
+  lmdb::dbi open_dbi(const char* const name = nullptr,
+                     const unsigned int flags = lmdb::dbi::default_flags) {
+    auto result = lmdb::dbi::open(_txn, name, flags);
+    _leader->_dbis[result.handle()] = {name ? name : "", flags & ~static_cast<unsigned int>(MDB_CREATE)};
+    return result;
+  }
+
+  /**
+   * Stores a key/value pair and records it for replication.
+   *
+   * @throws lmdb::error on failure
+   */
+  bool put(const MDB_dbi dbi,
+           const std::string_view key,
+           const std::string_view val,
+           const unsigned int flags = lmdb::dbi::default_put_flags) {
+    if (flags & MDB_RESERVE) {
+      error::raise("repl_txn::put: MDB_RESERVE cannot be replicated", EINVAL);
+    }
+    const MDB_val keyV{key.size(), const_cast<char*>(key.data())};
+    MDB_val valV{val.size(), const_cast<char*>(val.data())};
+    const bool ok = lmdb::dbi_put(_txn, dbi, &keyV, &valV, flags);
+    if (ok) record(op_put, dbi, key, &val);
+    return ok;
+  }
+
+  /**
+   * Removes a key and records the removal for replication.
+   *
+   * @throws lmdb::error on failure
+   */
+  bool del(const MDB_dbi dbi,
+           const std::string_view key) {
+    const MDB_val keyV{key.size(), const_cast<char*>(key.data())};
+    const bool ok = lmdb::dbi_del(_txn, dbi, &keyV);
+    if (ok) record(op_del, dbi, key);
+    return ok;
+  }
+
+  /**
+   * Removes a key/value pair and records the removal for replication.
+   *
+   * @throws lmdb::error on failure
+   */
+  bool del(const MDB_dbi dbi,
+           const std::string_view key,
+           const std::string_view val) {
+    const MDB_val keyV{key.size(), const_cast<char*>(key.data())};
+    const MDB_val valV{val.size(), const_cast<char*>(val.data())};
+    const bool ok = lmdb::dbi_del(_txn, dbi, &keyV, &valV);
+    if (ok) record(op_del_dup, dbi, key, &val);
+    return ok;
+  }
+
+  /**
+   * Empties (or deletes) a database and records it for replication.
+   *
+   * @throws lmdb::error on failure
+   */
+  void drop(const MDB_dbi dbi,
+            const bool del = false) {
+    const auto index = index_of(dbi);
+    lmdb::dbi_drop(_txn, dbi, del);
+    _ops.push_back(static_cast<char>(del ? op_drop_del : op_drop));
+    detail::put_varint(_ops, index);
+    detail::put_bytes(_ops, {});
+    ++_count;
+  }
+
+  /**
+   * Commits this transaction and emits its frame to the leader's sink.
+   *
+   * @throws lmdb::error on failure
+   */
+  void commit() {
+    std::string result;
+    if (_count) result = frame();
+    _txn.commit();
+    if (_count && _leader->_sink) _leader->_sink(result);
+    if (_count && _leader->_tap) _leader->_tap(result);
+    _ops.clear();
+    _count = 0;
+    if (_lock.owns_lock()) _lock.unlock();
+  }
+
+  /**
+   * Aborts this transaction. Nothing is logged.
+   */
+  void abort() noexcept {
+    _txn.abort();
+    _ops.clear();
+    _count = 0;
+    if (_lock.owns_lock()) _lock.unlock();
+  }
+};
+
+inline lmdb::repl_txn
+lmdb::repl_leader::begin() {
+  return repl_txn{*this};
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Replication: Follower */
+
+/**
+ * Applies a replication log to a follower environment.
+ *
+ * Complete frames are applied in batches of up to `max_batch` frames per
+ * write transaction. Keys beyond the current end of a database are written
+ * with `MDB_APPEND`. The last applied leader transaction ID is stored in a
+ * metadata database in the same transaction as the data, so frames that were
+ * already applied are skipped when a log is replayed.
+ */
+class lmdb::repl_follower {
+protected:
+  struct target {
+    MDB_dbi dbi;
+    lmdb::cursor cur;
+    std::string tail;
+    bool tail_known{false};
+    bool dropped{false};
+  };
+
+  MDB_env* _env;
+  lmdb::dbi _meta;
+  std::size_t _max_batch;
+  std::uint64_t _applied{0};
+  std::string _pending;
+
+
+  void put(MDB_txn* const txn,
+           target& t,
+           const std::string_view key,
+           const std::string_view val) {
+    if (!t.tail_known) {
+      std::string_view k, v;
+      if (t.cur.get(k, v, MDB_LAST)) t.tail = k;
+      else t.tail.clear();
+      t.tail_known = true;
+    }
+    const MDB_val a{key.size(), const_cast<char*>(key.data())};
+    const MDB_val b{t.tail.size(), const_cast<char*>(t.tail.data())};
+    if (t.tail.empty() || lmdb::dbi_cmp(txn, t.dbi, &a, &b) > 0) {
+      t.cur.put(key, val, MDB_APPEND);
+      t.tail = key;
+    } else {
+      t.cur.put(key, val);
+    }
+  }
+
+  [[noreturn]] static void corrupt() {
+    error::raise("repl_follower: malformed frame", MDB_CORRUPTED);
+  }
+
+  void apply(const std::vector<std::string_view>& frames) {
+    auto txn = lmdb::txn::begin(_env);
+    std::uint64_t last = _applied;
+
+    {
+      std::map<std::string, target, std::less<>> targets;
+
+      for (auto body : frames) {
+        std::uint64_t id, ndbis, nops;
+        if (!detail::get_varint(body, id)) corrupt();
+        if (id <= last) continue;
+
+        if (!detail::get_varint(body, ndbis)) corrupt();
+        std::vector<target*> table;
+        for (std::uint64_t i = 0; i < ndbis; ++i) {
+          std::string_view name;
+          std::uint64_t flags;
+          if (!detail::get_bytes(body, name) || !detail::get_varint(body, flags)) corrupt();
+          auto it = targets.find(name);
+          if (it == targets.end() || it->second.dropped) {
+            const auto db = name.empty()
+              ? lmdb::dbi::open(txn, nullptr, static_cast<unsigned int>(flags) | MDB_CREATE)
+              : lmdb::dbi::open(txn, name, static_cast<unsigned int>(flags) | MDB_CREATE);
+            target t{db.handle(), lmdb::cursor::open(txn, db), {}, false, false};
+            if (it == targets.end()) it = targets.emplace(std::string(name), std::move(t)).first;
+            else it->second = std::move(t);
+          }
+          table.push_back(&it->second);
+        }
+
+        if (!detail::get_varint(body, nops)) corrupt();
+        for (std::uint64_t i = 0; i < nops; ++i) {
+          if (body.empty()) corrupt();
+          const auto kind = static_cast<unsigned char>(body[0]);
+          body.remove_prefix(1);
+          std::uint64_t index;
+          std::string_view key, val;
+          if (!detail::get_varint(body, index) || index >= table.size()) corrupt();
+          if (!detail::get_bytes(body, key)) corrupt();
+          target& t = *table[index];
+          if (t.dropped) corrupt();
+          const MDB_val keyV{key.size(), const_cast<char*>(key.data())};
+
+          switch (kind) {
+            case repl_txn::op_put:
+              if (!detail::get_bytes(body, val)) corrupt();
+              put(txn, t, key, val);
+              break;
+            case repl_txn::op_del:
+              lmdb::dbi_del(txn, t.dbi, &keyV);
+              t.tail_known = false;
+              break;
+            case repl_txn::op_del_dup: {
+              if (!detail::get_bytes(body, val)) corrupt();
+              const MDB_val valV{val.size(), const_cast<char*>(val.data())};
+              lmdb::dbi_del(txn, t.dbi, &keyV, &valV);
+              t.tail_known = false;
+              break;
+            }
+            case repl_txn::op_drop:
+              lmdb::dbi_drop(txn, t.dbi, false);
+              t.tail_known = false;
+              break;
+            case repl_txn::op_drop_del:
+              /* Later frames reopen (and recreate) the database by name. */
+              t.cur.close();
+              lmdb::dbi_drop(txn, t.dbi, true);
+              t.dropped = true;
+              break;
+            default:
+              corrupt();
+          }
+        }
+
+        last = id;
+      }
+    } /* cursors must be closed before the commit */
+
+    if (last == _applied) return;
+    const std::uint64_t stored = last;
+    _meta.put(txn, applied_key, lmdb::to_sv(stored));
+    txn.commit();
+    _applied = last;
+  }
+
+public:
+  static constexpr std::string_view applied_key = "applied_txnid";
+  static constexpr const char* default_meta_name = "__lmdbxx_repl";
+  static constexpr std::size_t default_max_batch = 1024;
+
+  /**
+   * Constructor.
+   *
+   * @param env the follower environment (needs one spare named database)
+   * @param meta_name name of the database holding the replication position
+   * @param max_batch maximum number of frames applied per write transaction
+   * @throws lmdb::error on failure
+   */
+  repl_follower(MDB_env* const env,
+                const char* const meta_name = default_meta_name,
+                const std::size_t max_batch = default_max_batch)
+    : _env{env},
+      _max_batch{max_batch ? max_batch : 1} {
+    auto txn = lmdb::txn::begin(env);
+    _meta = lmdb::dbi::open(txn, meta_name, MDB_CREATE);
+    std::string_view v;
+    if (_meta.get(txn, applied_key, v)) {
+      _applied = lmdb::from_sv<std::uint64_t>(v);
+    }
+    txn.commit();
+  }
+
+  /**
+   * Returns the ID of the last leader transaction applied.
+   */
+  std::uint64_t applied() const noexcept {
+    return _applied;
+  }
+
+  /**
+   * Returns the number of buffered bytes that do not yet form a full frame.
+   */
+  std::size_t pending() const noexcept {
+    return _pending.size();
+  }
+
+  /**
+   * Feeds log bytes to the follower, applying every complete frame.
+   *
+   * Bytes may be split arbitrarily between calls.
+   *
+   * @returns the number of complete frames consumed
+   * @throws lmdb::corrupted_error if the log is malformed
+   * @throws lmdb::error on failure
+   */
+  std::size_t feed(const std::string_view bytes) {
+    _pending.append(bytes.data(), bytes.size());
+
+    std::string_view in = _pending;
+    std::vector<std::string_view> frames;
+    std::size_t consumed = 0;
+
+    while (!in.empty()) {
+      if (static_cast<unsigned char>(in[0]) != 0xA7) corrupt();
+      std::string_view rest = in.substr(1);
+      std::uint64_t length;
+      if (!detail::get_varint(rest, length)) {
+        if (rest.size() >= 10) corrupt(); /* longer than any varint */
+        break;
+      }
+      if (length > _pending.max_size() - 4) corrupt(); /* can never arrive */
+      const auto size = static_cast<std::size_t>(length);
+      if (size > rest.size() || rest.size() - size < 4) break;
+
+      const auto body = rest.substr(0, size);
+      std::uint32_t sum = 0;
+      for (std::size_t i = 0; i < 4; ++i) {
+        sum |= static_cast<std::uint32_t>(static_cast<unsigned char>(rest[size + i])) << (8 * i);
+      }
+      if (sum != detail::checksum(body)) {
+        error::raise("repl_follower: checksum mismatch", MDB_CORRUPTED);
+      }
+
+      frames.push_back(body);
+      in = rest.substr(size + 4);
+      consumed = _pending.size() - in.size();
+    }
+
+    for (std::size_t i = 0; i < frames.size(); i += _max_batch) {
+      const auto end = std::min(frames.size(), i + _max_batch);
+      apply(std::vector<std::string_view>(frames.begin() + i, frames.begin() + end));
+    }
+
+    _pending.erase(0, consumed);
+    return frames.size();
+  }
+
+#ifndef _WIN32
+  /**
+   * Reads whatever is available from a file descriptor (blocking if the
+   * descriptor is blocking) and feeds it to the follower.
+   *
+   * @retval true  if bytes were read
+   * @retval false on end of file
+   * @throws lmdb::error on failure
+   */
+  bool read_fd(const int fd) {
+    char buffer[65536];
+    for (;;) {
+      const auto n = ::read(fd, buffer, sizeof(buffer));
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        error::raise("repl_follower: read", errno);
+      }
+      if (n == 0) return false;
+      feed(std::string_view(buffer, static_cast<std::size_t>(n)));
+      return true;
+    }
+  }
+#endif
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_REPLICATION_H */
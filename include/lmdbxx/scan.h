@@ -0,0 +1,192 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_SCAN_H
+#define LMDBXX_SCAN_H
+
+/**
+ * <lmdbxx/scan.h> - Long-running scans for lmdb++.
+ *
+ * A read transaction pins the pages of its snapshot for as long as it is
+ * open, so a scan that takes minutes forces writers to allocate fresh pages
+ * the whole time. `lmdb::refreshing_scan` bounds the age of its snapshot by
+ * periodically resetting and renewing the transaction, then re-seeking to
+ * where it left off.
+ */
+
+#include "lmdb++.h"
+
+#include <chrono>      /* for std::chrono::* */
+#include <string>      /* for std::string */
+#include <string_view> /* for std::string_view */
+
+namespace lmdb {
+  class refreshing_scan;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Refreshing Scans */
+
+/**
+ * Forward cursor iteration over a database that periodically moves to the
+ * latest snapshot.
+ *
+ * Each refresh calls `mdb_txn_reset()` + `mdb_txn_renew()` on the read-only
+ * transaction, renews the cursor and re-seeks with `MDB_SET_RANGE` (or
+ * `MDB_GET_BOTH_RANGE` for `MDB_DUPSORT` databases) just past the last
+ * returned record. The scan therefore never returns a record twice and
+ * never goes backwards, but it is not a consistent snapshot. Records
+ * written behind the scan position are missed, and records written ahead
+ * of it may be seen.
+ *
+ * @warning Any `std::string_view` obtained through the transaction, including
+ *          those returned by earlier calls to `next()`, is invalidated by a
+ *          refresh.
+ * @note Instances of this class are movable, but not copyable.
+ */
+class lmdb::refreshing_scan {
+public:
+  using clock = std::chrono::steady_clock;
+
+protected:
+  MDB_txn* _txn;
+  lmdb::cursor _cursor;
+  bool _dupsort{false};
+  bool _started{false};
+  bool _done{false};
+  bool _reseek{false};
+  std::string _from;
+  std::string_view _key;
+  std::string_view _val;
+  std::string _resume_key;
+  std::string _resume_val;
+  std::size_t _max_records{0};
+  clock::duration _max_age{};
+  std::size_t _since_refresh{0};
+  clock::time_point _snapshot_time;
+  std::size_t _refreshes{0};
+
+  bool seek_after_resume() {
+    _key = _resume_key;
+    if (_dupsort) {
+      _val = _resume_val;
+      if (_cursor.get(_key, _val, MDB_GET_BOTH_RANGE)) {
+        return _val != _resume_val || _cursor.get(_key, _val, MDB_NEXT);
+      }
+      _key = _resume_key;
+      if (!_cursor.get(_key, _val, MDB_SET_RANGE)) return false;
+      return _key != _resume_key || _cursor.get(_key, _val, MDB_NEXT_NODUP);
+    }
+    if (!_cursor.get(_key, _val, MDB_SET_RANGE)) return false;
+    return _key != _resume_key || _cursor.get(_key, _val, MDB_NEXT);
+  }
+
+  bool due() const noexcept {
+    if (_max_records > 0 && _since_refresh >= _max_records) return true;
+    if (_max_age.count() > 0 && clock::now() - _snapshot_time >= _max_age) return true;
+    return false;
+  }
+
+public:
+  /**
+   * Constructor.
+   *
+   * @param txn a read-only transaction, which this scan will reset and renew
+   * @param dbi the database to scan
+   * @param from the first key to return (or the start of the database, if empty)
+   * @throws lmdb::error on failure
+   */
+  refreshing_scan(MDB_txn* const txn,
+                  const MDB_dbi dbi,
+                  const std::string_view from = {})
+    : _txn{txn},
+      _cursor{lmdb::cursor::open(txn, dbi)},
+      _from{from},
+      _snapshot_time{clock::now()} {
+    unsigned int flags = 0;
+    lmdb::dbi_flags(txn, dbi, &flags);
+    _dupsort = (flags & MDB_DUPSORT) != 0;
+  }
+
+  /**
+   * Refreshes after every `count` records (zero disables the limit).
+   */
+  refreshing_scan& set_max_records(const std::size_t count) noexcept {
+    _max_records = count;
+    return *this;
+  }
+
+  /**
+   * Refreshes once the snapshot is older than `age` (zero disables the limit).
+   */
+  template<class Rep, class Period>
+  refreshing_scan& set_max_age(const std::chrono::duration<Rep, Period> age) noexcept {
+    _max_age = std::chrono::duration_cast<clock::duration>(age);
+    return *this;
+  }
+
+  /**
+   * Retrieves the next key/value pair, refreshing the snapshot first if
+   * it is due.
+   *
+   * @retval true  if a record was retrieved
+   * @retval false at the end of the database
+   * @throws lmdb::error on failure
+   */
+  bool next(std::string_view& key,
+            std::string_view& val) {
+    if (_done) return false;
+    if (_started && !_reseek && due()) refresh();
+
+    bool found;
+    if (!_started) {
+      _started = true;
+      _key = _from;
+      found = _cursor.get(_key, _val, _from.empty() ? MDB_FIRST : MDB_SET_RANGE);
+    } else if (_reseek) {
+      _reseek = false;
+      found = seek_after_resume();
+    } else {
+      found = _cursor.get(_key, _val, MDB_NEXT);
+    }
+
+    if (!found) {
+      _done = true;
+      return false;
+    }
+    ++_since_refresh;
+    key = _key;
+    val = _val;
+    return true;
+  }
+
+  /**
+   * Moves the scan to the latest snapshot now, releasing the old one. The
+   * next call to `next()` continues after the last record returned.
+   *
+   * @throws lmdb::error on failure
+   */
+  void refresh() {
+    if (_started && !_reseek) {
+      _resume_key.assign(_key.data(), _key.size());
+      _resume_val.assign(_val.data(), _val.size());
+      _reseek = true;
+    }
+    lmdb::txn_reset(_txn);
+    lmdb::txn_renew(_txn);
+    _cursor.renew(_txn);
+    _since_refresh = 0;
+    _snapshot_time = clock::now();
+    ++_refreshes;
+  }
+
+  /**
+   * Returns the number of refreshes performed so far.
+   */
+  std::size_t refreshes() const noexcept {
+    return _refreshes;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_SCAN_H */
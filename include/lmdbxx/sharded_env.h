@@ -0,0 +1,366 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_SHARDED_ENV_H
+#define LMDBXX_SHARDED_ENV_H
+
+/**
+ * <lmdbxx/sharded_env.h> - Partitioned multi-environment store for lmdb++.
+ *
+ * LMDB allows one writer per environment. `lmdb::sharded_env` partitions
+ * keys over N independent environments (one directory each), by hash or by
+ * key range, and runs one writer thread per shard, so write throughput can
+ * scale with the number of shards. Each writer commits whatever has been
+ * queued for its shard in a single transaction.
+ */
+
+#include "lmdb++.h"
+#include "detail.h"
+#include "merge_iterator.h"
+
+#include <algorithm>          /* for std::upper_bound() */
+#include <condition_variable> /* for std::condition_variable */
+#include <cstdint>            /* for std::uint32_t */
+#include <deque>              /* for std::deque */
+#include <exception>          /* for std::exception_ptr, std::make_exception_ptr() */
+#include <filesystem>         /* for std::filesystem::create_directories() */
+#include <functional>         /* for std::function */
+#include <future>             /* for std::future, std::promise */
+#include <memory>             /* for std::unique_ptr */
+#include <mutex>              /* for std::mutex, std::unique_lock */
+#include <string>             /* for std::string */
+#include <string_view>        /* for std::string_view */
+#include <thread>             /* for std::thread */
+#include <utility>            /* for std::move() */
+#include <vector>             /* for std::vector */
+
+namespace lmdb {
+  class sharded_env;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Sharded Environments */
+
+/**
+ * A key/value store partitioned over several LMDB environments.
+ *
+ * Writes are queued to the owning shard's writer thread and complete
+ * asynchronously (`put_async()`/`del_async()`) or synchronously (`put()`/
+ * `del()`). Writes to the same shard are applied in submission order, but
+ * there is no atomicity or ordering across shards. A write that fails only
+ * fails its own future: keys LMDB would reject are refused before they are
+ * queued, and a batch whose transaction fails is retried one write per
+ * transaction. Reads use a read-only transaction on the calling thread.
+ * `scan()` merges the shards' cursors into one ordered stream with an
+ * `lmdb::merge_iterator`.
+ *
+ * @note Instances of this class are neither copyable nor movable.
+ */
+class lmdb::sharded_env {
+public:
+  /** Maps a key to a shard index in `[0, shards)`. */
+  using partitioner = std::function<std::size_t(std::string_view key, std::size_t shards)>;
+  /** Configures a shard's environment before it is opened. */
+  using configurator = std::function<void(lmdb::env& env)>;
+
+  static constexpr std::size_t default_max_batch = 4096;
+
+  /**
+   * Returns a partitioner that spreads keys by hash.
+   */
+  static partitioner hash_partitioner() {
+    return [](const std::string_view key, const std::size_t shards) -> std::size_t {
+      return detail::checksum(key) % shards;
+    };
+  }
+
+  /**
+   * Returns a partitioner that sends keys below `splits[0]` to shard 0, keys
+   * in `[splits[0], splits[1])` to shard 1, and so on. `splits` must be
+   * sorted and hold one element fewer than there are shards.
+   */
+  static partitioner range_partitioner(std::vector<std::string> splits) {
+    return [splits = std::move(splits)](const std::string_view key, std::size_t) -> std::size_t {
+      return static_cast<std::size_t>(std::upper_bound(splits.begin(), splits.end(), key) - splits.begin());
+    };
+  }
+
+protected:
+  struct op {
+    bool del;
+    std::string key;
+    std::string val;
+    std::promise<bool> done;
+  };
+
+  struct shard {
+    lmdb::env env{nullptr};
+    MDB_dbi dbi{0};
+    std::size_t max_key{0};
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<op> queue;
+    bool stop{false};
+    std::thread writer;
+  };
+
+  partitioner _partitioner;
+  std::size_t _max_batch;
+  std::vector<std::unique_ptr<shard>> _shards;
+
+  void write_loop(shard& s) {
+    std::unique_lock<std::mutex> lock{s.mutex};
+    for (;;) {
+      s.cv.wait(lock, [&s] { return s.stop || !s.queue.empty(); });
+      if (s.queue.empty()) return;
+
+      std::vector<op> batch;
+      while (!s.queue.empty() && batch.size() < _max_batch) {
+        batch.push_back(std::move(s.queue.front()));
+        s.queue.pop_front();
+      }
+      lock.unlock();
+
+      std::vector<bool> results;
+      try {
+        auto txn = lmdb::txn::begin(s.env);
+        for (auto& o : batch) results.push_back(apply(txn, s.dbi, o));
+        txn.commit();
+      } catch (...) {
+        results.clear();
+        if (batch.size() == 1) batch[0].done.set_exception(std::current_exception());
+      }
+      if (results.size() == batch.size()) {
+        for (std::size_t i = 0; i < batch.size(); ++i) batch[i].done.set_value(results[i]);
+      } else if (batch.size() > 1) {
+        /* retry one transaction per write, so that only the bad ones fail */
+        for (auto& o : batch) {
+          try {
+            auto txn = lmdb::txn::begin(s.env);
+            const bool result = apply(txn, s.dbi, o);
+            txn.commit();
+            o.done.set_value(result);
+          } catch (...) {
+            o.done.set_exception(std::current_exception());
+          }
+        }
+      }
+
+      lock.lock();
+    }
+  }
+
+  static bool apply(MDB_txn* const txn,
+                    const MDB_dbi dbi,
+                    const op& o) {
+    return o.del ? lmdb::dbi{dbi}.del(txn, o.key) : lmdb::dbi{dbi}.put(txn, o.key, o.val);
+  }
+
+  std::future<bool> submit(const bool del,
+                           const std::string_view key,
+                           const std::string_view val) {
+    shard& s = *_shards[shard_of(key)];
+    if (key.empty() || key.size() > s.max_key) {
+      /* fail here rather than in the writer's batch */
+      std::promise<bool> rejected;
+      rejected.set_exception(std::make_exception_ptr(lmdb::runtime_error{"sharded_env: key size", MDB_BAD_VALSIZE}));
+      return rejected.get_future();
+    }
+    std::future<bool> result;
+    {
+      std::lock_guard<std::mutex> lock{s.mutex};
+      if (s.stop) error::raise("sharded_env: stopped", EINVAL);
+      s.queue.push_back(op{del, std::string{key}, std::string{val}, {}});
+      result = s.queue.back().done.get_future();
+    }
+    s.cv.notify_one();
+    return result;
+  }
+
+public:
+  /**
+   * Constructor. Opens (creating if needed) `dir/shard-0` ... `dir/shard-N-1`
+   * and starts one writer thread per shard.
+   *
+   * @param dir the parent directory
+   * @param shards the number of shards
+   * @param part the partitioner (must not change for an existing store)
+   * @param flags environment flags
+   * @param configure called on each environment before it is opened
+   * @param max_batch maximum number of writes committed per transaction
+   * @throws lmdb::error on failure
+   */
+  sharded_env(const std::string& dir,
+              const std::size_t shards,
+              partitioner part = hash_partitioner(),
+              const unsigned int flags = lmdb::env::default_flags,
+              const configurator& configure = {},
+              const std::size_t max_batch = default_max_batch)
+    : _partitioner{std::move(part)},
+      _max_batch{max_batch ? max_batch : 1} {
+    if (shards == 0) error::raise("sharded_env: no shards", EINVAL);
+    try {
+      for (std::size_t i = 0; i < shards; ++i) {
+        auto s = std::make_unique<shard>();
+        const auto path = dir + "/shard-" + std::to_string(i) + "/";
+        std::filesystem::create_directories(path);
+        s->env = lmdb::env::create();
+        if (configure) configure(s->env);
+        s->env.open(path.c_str(), flags);
+        s->max_key = lmdb::env_get_max_keysize(s->env);
+        auto txn = lmdb::txn::begin(s->env);
+        s->dbi = lmdb::dbi::open(txn).handle();
+        txn.commit();
+        _shards.push_back(std::move(s));
+      }
+      for (auto& s : _shards) {
+        s->writer = std::thread{[this, p = s.get()] { write_loop(*p); }};
+      }
+    } catch (...) {
+      stop();
+      throw;
+    }
+  }
+
+  sharded_env(const sharded_env&) = delete;
+  sharded_env& operator=(const sharded_env&) = delete;
+
+  /**
+   * Destructor. Commits the writes already queued, then stops the writers.
+   */
+  ~sharded_env() noexcept {
+    stop();
+  }
+
+  /**
+   * Stops the writer threads after they have drained their queues.
+   *
+   * @note this method is idempotent
+   */
+  void stop() noexcept {
+    for (auto& s : _shards) {
+      {
+        std::lock_guard<std::mutex> lock{s->mutex};
+        s->stop = true;
+      }
+      s->cv.notify_all();
+    }
+    for (auto& s : _shards) {
+      if (s->writer.joinable()) s->writer.join();
+    }
+  }
+
+  /**
+   * Returns the number of shards.
+   */
+  std::size_t size() const noexcept {
+    return _shards.size();
+  }
+
+  /**
+   * Returns the index of the shard owning `key`.
+   */
+  std::size_t shard_of(const std::string_view key) const {
+    return _partitioner(key, _shards.size()) % _shards.size();
+  }
+
+  /**
+   * Returns the environment of shard `index`.
+   */
+  lmdb::env& env(const std::size_t index) const {
+    return _shards.at(index)->env;
+  }
+
+  /**
+   * Queues a key/value pair for the owning shard's writer.
+   *
+   * @returns a future that becomes ready once the write has committed
+   */
+  std::future<bool> put_async(const std::string_view key,
+                              const std::string_view val) {
+    return submit(false, key, val);
+  }
+
+  /**
+   * Queues the removal of a key for the owning shard's writer.
+   *
+   * @returns a future holding whether the key existed, once committed
+   */
+  std::future<bool> del_async(const std::string_view key) {
+    return submit(true, key, {});
+  }
+
+  /**
+   * Stores a key/value pair and waits for the commit.
+   *
+   * @throws lmdb::error on failure
+   */
+  bool put(const std::string_view key,
+           const std::string_view val) {
+    return put_async(key, val).get();
+  }
+
+  /**
+   * Removes a key and waits for the commit.
+   *
+   * @throws lmdb::error on failure
+   */
+  bool del(const std::string_view key) {
+    return del_async(key).get();
+  }
+
+  /**
+   * Retrieves a copy of the value stored under `key`.
+   *
+   * @retval true  if the key was found
+   * @retval false if the key was not found
+   * @throws lmdb::error on failure
+   */
+  bool get(const std::string_view key,
+           std::string& val) const {
+    const shard& s = *_shards[shard_of(key)];
+    auto txn = lmdb::txn::begin(s.env, nullptr, MDB_RDONLY);
+    std::string_view v;
+    if (!lmdb::dbi{s.dbi}.get(txn, key, v)) return false;
+    val.assign(v.data(), v.size());
+    return true;
+  }
+
+  /**
+   * Calls `fn(key, val)` for every key in `[from, to)` across all shards,
+   * in key order, until `fn` returns false. An empty `to` means no upper
+   * bound. Each shard is read from its own snapshot.
+   *
+   * @returns the number of records visited
+   * @throws lmdb::error on failure
+   */
+  template<class F>
+  std::size_t scan(const std::string_view from,
+                   const std::string_view to,
+                   F&& fn) const {
+    std::vector<lmdb::txn> txns;
+    std::vector<lmdb::cursor> cursors;
+    std::vector<MDB_cursor*> handles;
+    txns.reserve(_shards.size());
+    cursors.reserve(_shards.size());
+    for (const auto& s : _shards) {
+      txns.push_back(lmdb::txn::begin(s->env, nullptr, MDB_RDONLY));
+      cursors.push_back(lmdb::cursor::open(txns.back(), s->dbi));
+      handles.push_back(cursors.back());
+    }
+
+    lmdb::merge_iterator merged{handles};
+    merged.seek(from);
+    std::size_t count = 0;
+    std::string_view key, val;
+    while (merged.next(key, val)) {
+      if (!to.empty() && key >= to) break;
+      ++count;
+      if (!fn(key, val)) break;
+    }
+    return count;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_SHARDED_ENV_H */
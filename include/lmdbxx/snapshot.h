@@ -0,0 +1,141 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_SNAPSHOT_H
+#define LMDBXX_SNAPSHOT_H
+
+/**
+ * <lmdbxx/snapshot.h> - Read snapshots shared between threads for lmdb++.
+ *
+ * With `MDB_NOTLS`, a read-only transaction is not bound to the thread that
+ * created it. `lmdb::shared_snapshot` makes use of that: it is a
+ * reference-counted read-only transaction on which several threads (or
+ * migrating coroutines) can open their own cursors, so that a parallel
+ * query sees one consistent snapshot and occupies a single reader slot.
+ */
+
+#include "lmdb++.h"
+
+#include <algorithm>   /* for std::find() */
+#include <memory>      /* for std::shared_ptr */
+#include <mutex>       /* for std::mutex, std::lock_guard */
+#include <string_view> /* for std::string_view */
+#include <vector>      /* for std::vector */
+
+namespace lmdb {
+  class shared_snapshot;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Shared Snapshots */
+
+/**
+ * Reference-counted read-only transaction usable from several threads.
+ *
+ * The transaction is aborted when the last copy is destroyed, whichever
+ * thread that happens on. Cursors opened through `cursor()` each belong to
+ * one thread at a time. LMDB lazily refreshes a transaction's view of a
+ * named database the first time the database is used, so this class does
+ * that first use under a lock.
+ *
+ * @warning Keep a copy of the snapshot alive for as long as any of its
+ *          cursors, or any value read through it, is in use.
+ * @note Instances of this class are copyable and movable.
+ */
+class lmdb::shared_snapshot {
+protected:
+  struct state {
+    lmdb::txn txn;
+    std::mutex mutex;
+    std::vector<MDB_dbi> prepared;
+
+    explicit state(lmdb::txn&& t) noexcept
+      : txn{std::move(t)} {}
+  };
+
+  std::shared_ptr<state> _state;
+
+  explicit shared_snapshot(std::shared_ptr<state> s) noexcept
+    : _state{std::move(s)} {}
+
+  void prepare(const MDB_dbi dbi) const {
+    std::lock_guard<std::mutex> lock{_state->mutex};
+    auto& prepared = _state->prepared;
+    if (std::find(prepared.begin(), prepared.end(), dbi) != prepared.end()) return;
+    lmdb::cursor::open(_state->txn, dbi).close();
+    prepared.push_back(dbi);
+  }
+
+public:
+  /**
+   * Begins a shared snapshot.
+   *
+   * @param env an environment opened with `MDB_NOTLS`
+   * @throws lmdb::error on failure, or with `EINVAL` without `MDB_NOTLS`
+   */
+  static shared_snapshot
+  begin(MDB_env* const env) {
+    unsigned int flags = 0;
+    lmdb::env_get_flags(env, &flags);
+    if (!(flags & MDB_NOTLS)) {
+      error::raise("shared_snapshot: environment was not opened with MDB_NOTLS", EINVAL);
+    }
+    return shared_snapshot{std::make_shared<state>(lmdb::txn::begin(env, nullptr, MDB_RDONLY))};
+  }
+
+  /**
+   * Returns the underlying `MDB_txn*` handle.
+   *
+   * @warning Only use it directly for databases already passed to
+   *          `cursor()` or `get()`, or while no other thread uses the snapshot.
+   */
+  MDB_txn* handle() const noexcept {
+    return _state ? _state->txn.handle() : nullptr;
+  }
+
+  /**
+   * Returns the number of copies sharing this snapshot.
+   */
+  long use_count() const noexcept {
+    return _state.use_count();
+  }
+
+  /**
+   * Drops this copy's reference; the transaction ends with the last one.
+   *
+   * @note this method is idempotent
+   */
+  void release() noexcept {
+    _state.reset();
+  }
+
+  /**
+   * Opens a cursor on this snapshot for the calling thread.
+   *
+   * @throws lmdb::error on failure
+   */
+  lmdb::cursor cursor(const MDB_dbi dbi) const {
+    std::lock_guard<std::mutex> lock{_state->mutex};
+    auto result = lmdb::cursor::open(_state->txn, dbi);
+    auto& prepared = _state->prepared;
+    if (std::find(prepared.begin(), prepared.end(), dbi) == prepared.end()) prepared.push_back(dbi);
+    return result;
+  }
+
+  /**
+   * Retrieves a value from the snapshot.
+   *
+   * @retval true  if the key was found
+   * @retval false if the key was not found
+   * @throws lmdb::error on failure
+   */
+  bool get(const MDB_dbi dbi,
+           const std::string_view key,
+           std::string_view& val) const {
+    prepare(dbi);
+    return lmdb::dbi{dbi}.get(_state->txn, key, val);
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_SNAPSHOT_H */
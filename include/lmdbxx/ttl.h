@@ -0,0 +1,304 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_TTL_H
+#define LMDBXX_TTL_H
+
+/**
+ * <lmdbxx/ttl.h> - Expiring keys for lmdb++.
+ *
+ * `lmdb::ttl_dbi` stores records that can expire. Each value carries its
+ * expiry time, so reads can ignore expired records without any extra
+ * lookup. An index database keyed by (expiry, key) lets a background reaper
+ * find expired records in expiry order. The reaper then deletes them in
+ * small write transactions, with no scan of the data.
+ */
+
+#include "lmdb++.h"
+#include "detail.h"
+#include "periodic.h"
+
+#include <atomic>      /* for std::atomic */
+#include <chrono>      /* for std::chrono::* */
+#include <cstddef>     /* for std::size_t */
+#include <cstdint>     /* for std::uint64_t */
+#include <exception>   /* for std::exception_ptr */
+#include <string>      /* for std::string */
+#include <string_view> /* for std::string_view */
+
+namespace lmdb {
+  class ttl_dbi;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Expiring Databases */
+
+/**
+ * A database of records with optional expiry times, plus its expiry index.
+ *
+ * Records live in the database `name`, and each value is prefixed with its
+ * expiry time: 8 big-endian bytes holding milliseconds since the epoch, or
+ * zero for no expiry. The index lives in `name` + `"__ttl"`. Its keys are
+ * the expiry time followed by the record key, with empty values. Expired
+ * records are invisible to `get()` immediately and are physically removed
+ * by `reap()`.
+ *
+ * @warning Access the records only through this class, since the value
+ *          format and the index must stay in sync. Not for `MDB_DUPSORT`.
+ * @note Instances of this class are neither copyable nor movable.
+ */
+class lmdb::ttl_dbi {
+public:
+  using clock = std::chrono::system_clock;
+
+  static constexpr std::size_t default_batch = 1000;
+
+protected:
+  MDB_env* _env;
+  MDB_dbi _data;
+  MDB_dbi _index;
+  std::size_t _batch{default_batch};
+  std::atomic<std::size_t> _reaped{0};
+  periodic_task _task;
+
+  static std::uint64_t to_millis(const clock::time_point t) noexcept {
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t.time_since_epoch()).count();
+    return ms > 0 ? static_cast<std::uint64_t>(ms) : 1; /* zero means "never" */
+  }
+
+  static std::string index_key(const std::uint64_t expiry,
+                               const std::string_view key) {
+    std::string result;
+    result.reserve(8 + key.size());
+    detail::put_be64(result, expiry);
+    result.append(key.data(), key.size());
+    return result;
+  }
+
+  /* Removes the index entry of the record currently stored under `key`. */
+  void unindex(MDB_txn* const txn,
+               const std::string_view key) {
+    std::string_view old;
+    if (!lmdb::dbi{_data}.get(txn, key, old) || old.size() < 8) return;
+    const std::uint64_t expiry = detail::get_be64(old);
+    if (expiry) lmdb::dbi{_index}.del(txn, index_key(expiry, key));
+  }
+
+  void store(MDB_txn* const txn,
+             const std::string_view key,
+             const std::string_view val,
+             const std::uint64_t expiry) {
+    unindex(txn, key);
+    std::string record;
+    record.reserve(8 + val.size());
+    detail::put_be64(record, expiry);
+    record.append(val.data(), val.size());
+    lmdb::dbi{_data}.put(txn, key, record);
+    if (expiry) lmdb::dbi{_index}.put(txn, index_key(expiry, key), {});
+  }
+
+public:
+  /**
+   * Constructor. Opens (creating if needed) the record and index databases.
+   *
+   * @param env the environment (`set_max_dbs()` must allow two more databases)
+   * @param name the name of the record database
+   * @throws lmdb::error on failure
+   */
+  ttl_dbi(MDB_env* const env,
+          const std::string& name)
+    : _env{env} {
+    auto txn = lmdb::txn::begin(env);
+    _data = lmdb::dbi::open(txn, name, MDB_CREATE);
+    _index = lmdb::dbi::open(txn, name + "__ttl", MDB_CREATE);
+    txn.commit();
+  }
+
+  ttl_dbi(const ttl_dbi&) = delete;
+  ttl_dbi& operator=(const ttl_dbi&) = delete;
+
+  /**
+   * Destructor. Stops the reaper.
+   */
+  ~ttl_dbi() noexcept {
+    stop();
+  }
+
+  /**
+   * Returns the record database's handle.
+   */
+  MDB_dbi data() const noexcept {
+    return _data;
+  }
+
+  /**
+   * Returns the index database's handle.
+   */
+  MDB_dbi index() const noexcept {
+    return _index;
+  }
+
+  /**
+   * Sets how many records `reap()` deletes per write transaction.
+   */
+  ttl_dbi& set_batch(const std::size_t records) noexcept {
+    _batch = records ? records : 1;
+    return *this;
+  }
+
+  /**
+   * Stores a record that never expires.
+   *
+   * @throws lmdb::error on failure
+   */
+  void put(MDB_txn* const txn,
+           const std::string_view key,
+           const std::string_view val) {
+    store(txn, key, val, 0);
+  }
+
+  /**
+   * Stores a record that expires at `expires`.
+   *
+   * @throws lmdb::error on failure
+   */
+  void put(MDB_txn* const txn,
+           const std::string_view key,
+           const std::string_view val,
+           const clock::time_point expires) {
+    store(txn, key, val, to_millis(expires));
+  }
+
+  /**
+   * Stores a record that expires `ttl` from now.
+   *
+   * @throws lmdb::error on failure
+   */
+  template<class Rep, class Period>
+  void put(MDB_txn* const txn,
+           const std::string_view key,
+           const std::string_view val,
+           const std::chrono::duration<Rep, Period> ttl) {
+    put(txn, key, val, clock::now() + std::chrono::duration_cast<clock::duration>(ttl));
+  }
+
+  /**
+   * Retrieves a record that has not expired.
+   *
+   * @retval true  if the key was found and has not expired
+   * @retval false otherwise
+   * @throws lmdb::error on failure
+   */
+  bool get(MDB_txn* const txn,
+           const std::string_view key,
+           std::string_view& val) const {
+    std::string_view record;
+    if (!lmdb::dbi{_data}.get(txn, key, record) || record.size() < 8) return false;
+    const std::uint64_t expiry = detail::get_be64(record);
+    if (expiry && expiry <= to_millis(clock::now())) return false;
+    val = record.substr(8);
+    return true;
+  }
+
+  /**
+   * Returns the expiry time of a record, or `clock::time_point::max()` if it
+   * never expires.
+   *
+   * @retval true  if the key was found (expired or not)
+   * @retval false if the key was not found
+   * @throws lmdb::error on failure
+   */
+  bool expiry(MDB_txn* const txn,
+              const std::string_view key,
+              clock::time_point& expires) const {
+    std::string_view record;
+    if (!lmdb::dbi{_data}.get(txn, key, record) || record.size() < 8) return false;
+    const std::uint64_t ms = detail::get_be64(record);
+    expires = ms ? clock::time_point{std::chrono::duration_cast<clock::duration>(std::chrono::milliseconds{ms})}
+                 : clock::time_point::max();
+    return true;
+  }
+
+  /**
+   * Removes a record and its index entry.
+   *
+   * @throws lmdb::error on failure
+   */
+  bool del(MDB_txn* const txn,
+           const std::string_view key) {
+    unindex(txn, key);
+    return lmdb::dbi{_data}.del(txn, key);
+  }
+
+  /**
+   * Deletes every record that expired before `now`, walking the index in
+   * expiry order, `set_batch()` records per write transaction.
+   *
+   * @returns the number of records deleted
+   * @throws lmdb::error on failure
+   */
+  std::size_t reap(const clock::time_point now = clock::now()) {
+    const std::uint64_t limit = to_millis(now);
+    std::size_t total = 0;
+    for (;;) {
+      std::size_t count = 0;
+      bool more = false;
+      auto txn = lmdb::txn::begin(_env);
+      {
+        auto cursor = lmdb::cursor::open(txn, _index);
+        lmdb::dbi data{_data};
+        std::string_view k, v;
+        bool found = cursor.get(k, v, MDB_FIRST);
+        while (found && k.size() >= 8 && detail::get_be64(k) <= limit) {
+          if (count == _batch) {
+            more = true;
+            break;
+          }
+          data.del(txn, k.substr(8));
+          cursor.del();
+          ++count;
+          found = cursor.get(k, v, MDB_NEXT);
+        }
+      } /* the cursor must be closed before the commit */
+      txn.commit();
+      total += count;
+      if (!more) break;
+    }
+    _reaped += total;
+    return total;
+  }
+
+  /**
+   * Returns the number of records deleted by `reap()` so far.
+   */
+  std::size_t reaped() const noexcept {
+    return _reaped;
+  }
+
+  /**
+   * Starts calling `reap()` every `interval` on a background thread.
+   */
+  template<class Rep, class Period>
+  void start(const std::chrono::duration<Rep, Period> interval) {
+    _task.start(interval, [this] { reap(); });
+  }
+
+  /**
+   * Stops the background reaper.
+   *
+   * @note this method is idempotent
+   */
+  void stop() noexcept {
+    _task.stop();
+  }
+
+  /**
+   * Returns the most recent exception thrown by the background reaper, if any.
+   */
+  std::exception_ptr last_error() const {
+    return _task.last_error();
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_TTL_H */
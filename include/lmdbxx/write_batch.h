@@ -0,0 +1,177 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef LMDBXX_WRITE_BATCH_H
+#define LMDBXX_WRITE_BATCH_H
+
+/**
+ * <lmdbxx/write_batch.h> - Write batches built outside transactions for lmdb++.
+ *
+ * With the plain interface, every mutation is made while a write transaction
+ * (and therefore the environment's writer lock) is held. `lmdb::write_batch`
+ * collects puts and deletes without any transaction. It keeps only the last
+ * mutation of each key, sorts them by database and key, and applies them in
+ * one write transaction with one cursor per database. Consecutive keys then
+ * usually land on the page the cursor is already on, and the lock is only
+ * held for the application itself.
+ */
+
+#include "lmdb++.h"
+
+#include <algorithm>        /* for std::stable_sort() */
+#include <cstddef>          /* for std::size_t */
+#include <cstring>          /* for std::memcpy() */
+#include <memory_resource>  /* for std::pmr::monotonic_buffer_resource */
+#include <string>           /* for std::string */
+#include <string_view>      /* for std::string_view */
+#include <vector>           /* for std::vector */
+
+namespace lmdb {
+  class write_batch;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Write Batches */
+
+/**
+ * An ordered, deduplicated set of mutations over one or more databases.
+ *
+ * Keys and values are copied into a monotonic arena, so building a batch
+ * costs no per-mutation `malloc()`. The arena is released by `clear()`.
+ * Mutations of the same key are collapsed when the batch is applied: the
+ * last one wins.
+ *
+ * @warning Not thread-safe. Not for `MDB_DUPSORT` databases.
+ * @note Instances of this class are neither copyable nor movable.
+ */
+class lmdb::write_batch {
+protected:
+  struct mutation {
+    MDB_dbi dbi;
+    std::string_view key;
+    std::string_view val;
+    bool del;
+  };
+
+  std::pmr::monotonic_buffer_resource _arena;
+  std::vector<mutation> _mutations;
+  std::size_t _bytes{0};
+
+  std::string_view store(const std::string_view bytes) {
+    if (bytes.empty()) return {};
+    auto* const p = static_cast<char*>(_arena.allocate(bytes.size(), 1));
+    std::memcpy(p, bytes.data(), bytes.size());
+    _bytes += bytes.size();
+    return {p, bytes.size()};
+  }
+
+public:
+  write_batch() = default;
+  write_batch(const write_batch&) = delete;
+  write_batch& operator=(const write_batch&) = delete;
+
+  /**
+   * Returns the number of mutations recorded (duplicates included).
+   */
+  std::size_t size() const noexcept {
+    return _mutations.size();
+  }
+
+  /**
+   * Returns whether the batch is empty.
+   */
+  bool empty() const noexcept {
+    return _mutations.empty();
+  }
+
+  /**
+   * Returns the number of key and value bytes held in the arena.
+   */
+  std::size_t bytes() const noexcept {
+    return _bytes;
+  }
+
+  /**
+   * Records a key/value pair to store.
+   */
+  write_batch& put(const MDB_dbi dbi,
+                   const std::string_view key,
+                   const std::string_view val) {
+    _mutations.push_back({dbi, store(key), store(val), false});
+    return *this;
+  }
+
+  /**
+   * Records a key to remove.
+   */
+  write_batch& del(const MDB_dbi dbi,
+                   const std::string_view key) {
+    _mutations.push_back({dbi, store(key), {}, true});
+    return *this;
+  }
+
+  /**
+   * Empties the batch and releases its arena.
+   */
+  void clear() noexcept {
+    _mutations.clear();
+    _arena.release();
+    _bytes = 0;
+  }
+
+  /**
+   * Applies the batch within an existing write transaction. The batch is
+   * sorted and deduplicated in the process, but not cleared.
+   *
+   * @returns the number of mutations applied after deduplication
+   * @throws lmdb::error on failure
+   */
+  std::size_t apply(MDB_txn* const txn) {
+    /* Sort by (dbi, key), keeping the insertion order of equal keys, and
+       keep only the last mutation of each key. */
+    std::stable_sort(_mutations.begin(), _mutations.end(), [](const mutation& a, const mutation& b) {
+      return a.dbi != b.dbi ? a.dbi < b.dbi : a.key < b.key;
+    });
+    std::size_t out = 0;
+    for (std::size_t i = 0; i < _mutations.size(); ++i) {
+      if (i + 1 < _mutations.size() && _mutations[i + 1].dbi == _mutations[i].dbi && _mutations[i + 1].key == _mutations[i].key) continue;
+      _mutations[out++] = _mutations[i];
+    }
+    _mutations.resize(out);
+
+    std::size_t i = 0;
+    while (i < _mutations.size()) {
+      const MDB_dbi dbi = _mutations[i].dbi;
+      auto cursor = lmdb::cursor::open(txn, dbi);
+      for (; i < _mutations.size() && _mutations[i].dbi == dbi; ++i) {
+        const auto& m = _mutations[i];
+        if (m.del) {
+          std::string_view k{m.key}, v;
+          if (cursor.get(k, v, MDB_SET)) cursor.del();
+        } else {
+          cursor.put(m.key, m.val);
+        }
+      }
+    }
+    return _mutations.size();
+  }
+
+  /**
+   * Applies the batch in a new write transaction, commits it, then clears
+   * the batch.
+   *
+   * @returns the number of mutations applied after deduplication
+   * @throws lmdb::error on failure (the batch is kept)
+   */
+  std::size_t apply(MDB_env* const env) {
+    if (_mutations.empty()) return 0;
+    auto txn = lmdb::txn::begin(env);
+    const std::size_t count = apply(txn.handle());
+    txn.commit();
+    clear();
+    return count;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* LMDBXX_WRITE_BATCH_H */